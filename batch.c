@@ -0,0 +1,468 @@
+#define _GNU_SOURCE
+#include <SDL.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "batch.h"
+#include "gles.h"
+#include "hash.h"
+#include "pixels.h"
+
+// Frames an instance runs before it goes back to a queue, long enough to
+// keep the queue locks out of the profile.
+#define BATCH_SLICE 16
+
+struct instance {
+    unsigned index;
+    const char *content;
+    bool loaded;
+    int fd;
+    GRetro retro;
+    enum retro_pixel_format format;
+    struct retro_audio_callback audio_callback;
+    struct retro_frame_time_callback frame_time;
+    uint64_t frames;
+    uint64_t video_hash, audio_hash;
+};
+
+// Instances waiting on one worker. The owner pushes and pops at the tail,
+// other workers steal from the head. An instance is in at most one queue,
+// so every ring has room for all of them.
+struct queue {
+    SDL_mutex *lock;
+    unsigned *items;
+    unsigned head, tail;
+};
+
+static struct {
+    const struct batch_config *config;
+    struct instance *instances;
+    struct queue *queues;
+    SDL_atomic_t remaining;
+    // libretro callbacks carry no context, so each worker points this at
+    // the instance it is running.
+    SDL_TLSID current;
+} g_batch;
+
+static struct instance *current(void) {
+    return SDL_TLSGet(g_batch.current);
+}
+
+static void instance_log(enum retro_log_level level, const char *fmt, ...) {
+    char buffer[1024];
+    va_list va;
+
+    if (level < RETRO_LOG_WARN)
+        return;
+
+    va_start(va, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, va);
+    va_end(va);
+
+    fprintf(stderr, "batch %u: %s", current()->index, buffer);
+}
+
+static bool instance_environment(unsigned cmd, void *data) {
+    struct instance *inst = current();
+
+    switch (cmd) {
+    case RETRO_ENVIRONMENT_GET_LOG_INTERFACE:
+        ((struct retro_log_callback*)data)->log = instance_log;
+        return true;
+    case RETRO_ENVIRONMENT_GET_CAN_DUPE:
+        *(bool*)data = true;
+        return true;
+    case RETRO_ENVIRONMENT_SET_PIXEL_FORMAT: {
+        enum retro_pixel_format fmt = *(const enum retro_pixel_format*)data;
+
+        if (fmt > RETRO_PIXEL_FORMAT_RGB565)
+            return false;
+        inst->format = fmt;
+        return true;
+    }
+    case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK:
+        inst->frame_time = *(const struct retro_frame_time_callback*)data;
+        return true;
+    case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK:
+        inst->audio_callback = *(const struct retro_audio_callback*)data;
+        return true;
+    case RETRO_ENVIRONMENT_SET_GEOMETRY:
+    case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void instance_video_refresh(const void *data, unsigned width, unsigned height, size_t pitch) {
+    struct instance *inst = current();
+    size_t row = (size_t)width * pixels_bpp(inst->format);
+    unsigned y;
+
+    if (!data || data == RETRO_HW_FRAME_BUFFER_VALID)
+        return;
+
+    for (y = 0; y < height; ++y)
+        inst->video_hash = hash64((const uint8_t*)data + y * pitch, row, inst->video_hash);
+}
+
+static void instance_audio_sample(int16_t left, int16_t right) {
+    struct instance *inst = current();
+    int16_t frame[2] = { left, right };
+
+    inst->audio_hash = hash64(frame, sizeof(frame), inst->audio_hash);
+}
+
+static size_t instance_audio_sample_batch(const int16_t *data, size_t frames) {
+    struct instance *inst = current();
+
+    inst->audio_hash = hash64(data, frames * 4, inst->audio_hash);
+    return frames;
+}
+
+static void instance_input_poll(void) {}
+
+static int16_t instance_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    return 0;
+}
+
+// Loads a private copy of the core. The dynamic loader would hand every
+// instance the same globals if they all opened the same file. On Linux the
+// copy is a memfd, which stays open so no later copy reuses its path.
+static void *load_copy(const void *core, size_t size, int *copy_fd) {
+#ifdef _WIN32
+    fprintf(stderr, "batch: private core copies are not supported on Windows\n");
+    return NULL;
+#else
+    char path[64];
+    size_t done = 0;
+    void *handle = NULL;
+    ssize_t n;
+    int fd;
+
+#ifdef __linux__
+    fd = memfd_create("core", MFD_CLOEXEC);
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+#else
+    snprintf(path, sizeof(path), "/tmp/sdlarch-core-XXXXXX");
+    fd = mkstemp(path);
+#endif
+    if (fd < 0)
+        return NULL;
+
+    while (done < size && (n = write(fd, (const char*)core + done, size - done)) > 0)
+        done += n;
+
+    if (done == size)
+        handle = SDL_LoadObject(path);
+
+#ifdef __linux__
+    if (handle) {
+        *copy_fd = fd;
+        return handle;
+    }
+#else
+    unlink(path);
+#endif
+    close(fd);
+    return handle;
+#endif
+}
+
+#define load_sym(V, S) (ok = ok && ((*(void**)&(V)) = SDL_LoadFunction(inst->retro.handle, #S)))
+
+static bool instance_load(struct instance *inst, const void *core, size_t core_size) {
+    void (*set_environment)(retro_environment_t) = NULL;
+    void (*set_video_refresh)(retro_video_refresh_t) = NULL;
+    void (*set_input_poll)(retro_input_poll_t) = NULL;
+    void (*set_input_state)(retro_input_state_t) = NULL;
+    void (*set_audio_sample)(retro_audio_sample_t) = NULL;
+    void (*set_audio_sample_batch)(retro_audio_sample_batch_t) = NULL;
+    struct retro_system_info system = {0};
+    struct retro_game_info info = { inst->content, NULL, 0, "" };
+    SDL_RWops *file;
+    bool ok = true;
+
+    if (!(inst->retro.handle = load_copy(core, core_size, &inst->fd))) {
+        fprintf(stderr, "batch %u: failed to load the core: %s\n", inst->index, SDL_GetError());
+        return false;
+    }
+
+    load_sym(inst->retro.retro_init, retro_init);
+    load_sym(inst->retro.retro_deinit, retro_deinit);
+    load_sym(inst->retro.retro_get_system_info, retro_get_system_info);
+    load_sym(inst->retro.retro_set_controller_port_device, retro_set_controller_port_device);
+    load_sym(inst->retro.retro_run, retro_run);
+    load_sym(inst->retro.retro_load_game, retro_load_game);
+    load_sym(inst->retro.retro_unload_game, retro_unload_game);
+    load_sym(set_environment, retro_set_environment);
+    load_sym(set_video_refresh, retro_set_video_refresh);
+    load_sym(set_input_poll, retro_set_input_poll);
+    load_sym(set_input_state, retro_set_input_state);
+    load_sym(set_audio_sample, retro_set_audio_sample);
+    load_sym(set_audio_sample_batch, retro_set_audio_sample_batch);
+    if (!ok) {
+        fprintf(stderr, "batch %u: the core is missing libretro symbols\n", inst->index);
+        return false;
+    }
+
+    set_environment(instance_environment);
+    set_video_refresh(instance_video_refresh);
+    set_input_poll(instance_input_poll);
+    set_input_state(instance_input_state);
+    set_audio_sample(instance_audio_sample);
+    set_audio_sample_batch(instance_audio_sample_batch);
+
+    inst->retro.retro_init();
+    inst->retro.initialized = true;
+    inst->retro.retro_get_system_info(&system);
+
+    if (!(file = SDL_RWFromFile(inst->content, "rb"))) {
+        fprintf(stderr, "batch %u: failed to open %s\n", inst->index, inst->content);
+        return false;
+    }
+
+    info.size = SDL_RWsize(file);
+    if (!system.need_fullpath) {
+        void *data = SDL_malloc(info.size ? info.size : 1);
+
+        if (data && info.size && !SDL_RWread(file, data, info.size, 1)) {
+            SDL_free(data);
+            data = NULL;
+        }
+        info.data = data;
+        ok = data != NULL;
+    }
+    SDL_RWclose(file);
+
+    ok = ok && inst->retro.retro_load_game(&info);
+    SDL_free((void*)info.data);
+    if (!ok) {
+        fprintf(stderr, "batch %u: the core failed to load %s\n", inst->index, inst->content);
+        return false;
+    }
+
+    inst->retro.retro_set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
+    inst->loaded = true;
+    return true;
+}
+
+static void instance_unload(struct instance *inst) {
+    if (inst->loaded)
+        inst->retro.retro_unload_game();
+    if (inst->retro.initialized)
+        inst->retro.retro_deinit();
+    if (inst->retro.handle)
+        SDL_UnloadObject(inst->retro.handle);
+#ifndef _WIN32
+    if (inst->fd >= 0)
+        close(inst->fd);
+#endif
+}
+
+// Returns whether the instance has frames left.
+static bool instance_step(struct instance *inst) {
+    uint64_t end = inst->frames + BATCH_SLICE;
+
+    if (end > g_batch.config->frames)
+        end = g_batch.config->frames;
+
+    for (; inst->frames < end; inst->frames++) {
+        if (inst->frame_time.callback)
+            inst->frame_time.callback(inst->frame_time.reference);
+        if (inst->audio_callback.callback)
+            inst->audio_callback.callback();
+        inst->retro.retro_run();
+    }
+
+    return inst->frames < g_batch.config->frames;
+}
+
+static void queue_push(struct queue *q, unsigned item) {
+    SDL_LockMutex(q->lock);
+    q->items[q->tail++ % g_batch.config->instances] = item;
+    SDL_UnlockMutex(q->lock);
+}
+
+static int queue_pop(struct queue *q, bool steal) {
+    int item = -1;
+
+    SDL_LockMutex(q->lock);
+    if (q->head != q->tail)
+        item = steal ? q->items[q->head++ % g_batch.config->instances] :
+                       q->items[--q->tail % g_batch.config->instances];
+    SDL_UnlockMutex(q->lock);
+
+    return item;
+}
+
+static int worker_thread(void *data) {
+    unsigned self = (unsigned)(uintptr_t)data, threads = g_batch.config->threads, i;
+
+    for (;;) {
+        int item = queue_pop(&g_batch.queues[self], false);
+
+        for (i = 1; item < 0 && i < threads; ++i)
+            item = queue_pop(&g_batch.queues[(self + i) % threads], true);
+
+        if (item < 0) {
+            if (!SDL_AtomicGet(&g_batch.remaining))
+                break;
+            // What is left is running on other workers, wait for a slice
+            // to end and be stolen.
+            SDL_Delay(1);
+            continue;
+        }
+
+        SDL_TLSSet(g_batch.current, &g_batch.instances[item], NULL);
+        if (instance_step(&g_batch.instances[item]))
+            queue_push(&g_batch.queues[self], item);
+        else
+            SDL_AtomicAdd(&g_batch.remaining, -1);
+    }
+
+    return 0;
+}
+
+static void *read_file(const char *path, size_t *size) {
+    void *data = NULL;
+    long n;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return NULL;
+
+    if (!fseek(fp, 0, SEEK_END) && (n = ftell(fp)) > 0 && !fseek(fp, 0, SEEK_SET) &&
+        (data = malloc(n)) && fread(data, 1, n, fp) != (size_t)n) {
+        free(data);
+        data = NULL;
+    }
+    fclose(fp);
+
+    *size = data ? (size_t)n : 0;
+    return data;
+}
+
+bool batch_run(const struct batch_config *config) {
+    struct batch_config cfg = *config;
+    SDL_Thread **threads = NULL;
+    Uint64 start, loaded, end, total = 0;
+    size_t core_size;
+    void *core;
+    unsigned i;
+    bool ok = true;
+
+    if (!cfg.instances || !cfg.num_contents)
+        return false;
+    if (!cfg.threads)
+        cfg.threads = SDL_GetCPUCount();
+    if (cfg.threads > cfg.instances)
+        cfg.threads = cfg.instances;
+
+    if (!(core = read_file(cfg.core, &core_size))) {
+        fprintf(stderr, "batch: failed to read %s\n", cfg.core);
+        return false;
+    }
+
+    memset(&g_batch, 0, sizeof(g_batch));
+    g_batch.config = &cfg;
+    g_batch.current = SDL_TLSCreate();
+    g_batch.instances = calloc(cfg.instances, sizeof(*g_batch.instances));
+    g_batch.queues = calloc(cfg.threads, sizeof(*g_batch.queues));
+    threads = calloc(cfg.threads, sizeof(*threads));
+    if (!g_batch.current || !g_batch.instances || !g_batch.queues || !threads) {
+        free(core);
+        return false;
+    }
+
+    // The cleanup below unloads every instance, loaded or not.
+    for (i = 0; i < cfg.instances; ++i)
+        g_batch.instances[i].fd = -1;
+
+    for (i = 0; i < cfg.threads; ++i) {
+        g_batch.queues[i].lock = SDL_CreateMutex();
+        g_batch.queues[i].items = calloc(cfg.instances, sizeof(unsigned));
+        ok = ok && g_batch.queues[i].lock && g_batch.queues[i].items;
+    }
+
+    // Loading stays on this thread, the dynamic loader serializes it anyway.
+    start = SDL_GetPerformanceCounter();
+    for (i = 0; ok && i < cfg.instances; ++i) {
+        struct instance *inst = &g_batch.instances[i];
+
+        inst->index = i;
+        inst->content = cfg.contents[i % cfg.num_contents];
+        inst->video_hash = HASH_SEED;
+        inst->audio_hash = HASH_SEED;
+
+        SDL_TLSSet(g_batch.current, inst, NULL);
+        ok = instance_load(inst, core, core_size);
+        if (ok)
+            queue_push(&g_batch.queues[i % cfg.threads], i);
+    }
+    free(core);
+    loaded = SDL_GetPerformanceCounter();
+
+    if (ok) {
+        unsigned started = 0;
+
+        SDL_AtomicSet(&g_batch.remaining, cfg.instances);
+        for (i = 0; i < cfg.threads; ++i) {
+            threads[i] = SDL_CreateThread(worker_thread, "batch", (void*)(uintptr_t)i);
+            if (threads[i])
+                started++;
+            else
+                fprintf(stderr, "batch: failed to start worker %u: %s\n", i, SDL_GetError());
+        }
+
+        // Workers steal from every queue, so any one of them finishes the
+        // run. Without any, this thread does the work.
+        if (!started)
+            worker_thread((void*)(uintptr_t)0);
+        for (i = 0; i < cfg.threads; ++i)
+            if (threads[i])
+                SDL_WaitThread(threads[i], NULL);
+    }
+    end = SDL_GetPerformanceCounter();
+
+    for (i = 0; i < cfg.instances; ++i) {
+        struct instance *inst = &g_batch.instances[i];
+
+        if (ok)
+            printf("batch: %u %s: %llu frames, video %016llx, audio %016llx\r\n", i, inst->content,
+                (unsigned long long)inst->frames, (unsigned long long)inst->video_hash,
+                (unsigned long long)inst->audio_hash);
+        total += inst->frames;
+
+        SDL_TLSSet(g_batch.current, inst, NULL);
+        instance_unload(inst);
+    }
+
+    if (ok) {
+        double load_s = (double)(loaded - start) / SDL_GetPerformanceFrequency();
+        double run_s = (double)(end - loaded) / SDL_GetPerformanceFrequency();
+
+        printf("batch: loaded %u instances in %.3f s\r\n", cfg.instances, load_s);
+        printf("batch: %llu frames in %.3f s on %u threads (%.1f fps)\r\n",
+            (unsigned long long)total, run_s, cfg.threads, run_s > 0 ? total / run_s : 0.0);
+    }
+
+    for (i = 0; i < cfg.threads; ++i) {
+        if (g_batch.queues[i].lock)
+            SDL_DestroyMutex(g_batch.queues[i].lock);
+        free(g_batch.queues[i].items);
+    }
+    free(g_batch.queues);
+    free(g_batch.instances);
+    free(threads);
+    memset(&g_batch, 0, sizeof(g_batch));
+
+    return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Runs many headless instances of a core in one process, for regression
+// and bot workloads that would otherwise start a process per content.
+// Each instance loads its own copy of the core, since cores keep their
+// state in globals, and the instances are stepped by a work stealing pool.
+// HW rendered cores are not supported.
+struct batch_config {
+    const char *core;
+    const char *const *contents; // instance i runs contents[i % num_contents]
+    unsigned num_contents;
+    unsigned instances;
+    unsigned threads;
+    uint64_t frames;             // per instance
+};
+
+// Prints the final hashes of every instance and the aggregate speed.
+// Returns false if any instance failed to load.
+bool batch_run(const struct batch_config *config);
@@ -0,0 +1,215 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cheats.h"
+#include "memmap.h"
+
+struct cheat {
+    bool enabled;
+    bool ram;
+    char code[256];
+    size_t address;
+    uint32_t value;
+    unsigned size;     // memory_search_size, 3 is a byte
+    uint32_t bit_mask; // address_bit_position, for the sub-byte sizes
+    bool big_endian;
+    unsigned type;
+};
+
+// One masked byte write.
+struct cheat_op {
+    uint8_t *ptr;
+    uint8_t mask, value;
+};
+
+static struct {
+    struct cheat *cheats;
+    unsigned num_cheats;
+    const char **codes;
+    unsigned num_codes;
+    struct cheat_op *ops;
+    unsigned num_ops;
+} g_cheats;
+
+static void strip_value(char *value) {
+    size_t len = strlen(value);
+
+    while (len && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+        value[--len] = '\0';
+
+    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+        memmove(value, value + 1, len - 2);
+        value[len - 2] = '\0';
+    }
+}
+
+static void set_key(struct cheat *c, const char *key, const char *value) {
+    if (!strcmp(key, "code"))
+        snprintf(c->code, sizeof(c->code), "%s", value);
+    else if (!strcmp(key, "enable"))
+        c->enabled = !strcmp(value, "true") || !strcmp(value, "1");
+    else if (!strcmp(key, "handler"))
+        c->ram = strtoul(value, NULL, 10) == 1;
+    else if (!strcmp(key, "address"))
+        c->address = strtoull(value, NULL, 0);
+    else if (!strcmp(key, "value"))
+        c->value = strtoul(value, NULL, 0);
+    else if (!strcmp(key, "memory_search_size"))
+        c->size = strtoul(value, NULL, 10);
+    else if (!strcmp(key, "address_bit_position"))
+        c->bit_mask = strtoul(value, NULL, 0);
+    else if (!strcmp(key, "big_endian"))
+        c->big_endian = !strcmp(value, "true") || !strcmp(value, "1");
+    else if (!strcmp(key, "cheat_type"))
+        c->type = strtoul(value, NULL, 10);
+}
+
+bool cheats_load(const char *path) {
+    char line[512];
+    unsigned i;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "cheats: failed to open %s\n", path);
+        return false;
+    }
+
+    cheats_deinit();
+
+    while (fgets(line, sizeof(line), fp)) {
+        char key[64], value[256];
+        unsigned n;
+        int len = 0;
+
+        if (line[0] == '#' || sscanf(line, " %63[^= \t] = %255[^\r\n]", key, value) != 2)
+            continue;
+
+        strip_value(value);
+
+        if (!strcmp(key, "cheats")) {
+            n = strtoul(value, NULL, 10);
+            free(g_cheats.cheats);
+            g_cheats.num_cheats = 0;
+            if (!(g_cheats.cheats = calloc(n ? n : 1, sizeof(*g_cheats.cheats)))) {
+                fclose(fp);
+                return false;
+            }
+            g_cheats.num_cheats = n;
+            for (i = 0; i < n; ++i) {
+                g_cheats.cheats[i].size = 3;
+                g_cheats.cheats[i].type = 1;
+            }
+            continue;
+        }
+
+        // Keys are cheat<n>_<name>.
+        if (strncmp(key, "cheat", 5) || sscanf(key + 5, "%u_%n", &n, &len) != 1 || !len)
+            continue;
+
+        if (n >= g_cheats.num_cheats) {
+            fprintf(stderr, "cheats: %s uses cheat%u beyond its count\n", path, n);
+            continue;
+        }
+
+        set_key(&g_cheats.cheats[n], key + 5 + len, value);
+    }
+
+    fclose(fp);
+
+    g_cheats.codes = calloc(g_cheats.num_cheats ? g_cheats.num_cheats : 1, sizeof(*g_cheats.codes));
+    if (!g_cheats.codes)
+        return false;
+
+    for (i = 0; i < g_cheats.num_cheats; ++i) {
+        const struct cheat *c = &g_cheats.cheats[i];
+
+        if (c->enabled && !c->ram && c->code[0])
+            g_cheats.codes[g_cheats.num_codes++] = c->code;
+    }
+
+    return true;
+}
+
+unsigned cheats_code_count(void) {
+    return g_cheats.num_codes;
+}
+
+const char *cheats_code(unsigned index) {
+    return index < g_cheats.num_codes ? g_cheats.codes[index] : NULL;
+}
+
+static bool add_op(size_t address, uint8_t mask, uint8_t value) {
+    uint8_t *ptr = memmap_lookup(address);
+
+    if (!ptr) {
+        fprintf(stderr, "cheats: address $%zx is not mapped\n", address);
+        return false;
+    }
+
+    g_cheats.ops[g_cheats.num_ops].ptr = ptr;
+    g_cheats.ops[g_cheats.num_ops].mask = mask;
+    g_cheats.ops[g_cheats.num_ops].value = value & mask;
+    g_cheats.num_ops++;
+    return true;
+}
+
+bool cheats_compile(void) {
+    unsigned i, b;
+
+    free(g_cheats.ops);
+    g_cheats.num_ops = 0;
+
+    // At most four byte writes per cheat.
+    g_cheats.ops = calloc(g_cheats.num_cheats ? g_cheats.num_cheats * 4 : 1, sizeof(*g_cheats.ops));
+    if (!g_cheats.ops)
+        return false;
+
+    for (i = 0; i < g_cheats.num_cheats; ++i) {
+        const struct cheat *c = &g_cheats.cheats[i];
+        unsigned bytes = c->size == 5 ? 4 : c->size == 4 ? 2 : 1;
+        uint32_t mask = c->size >= 3 ? 0xffffffff : c->bit_mask;
+        uint32_t value = c->value;
+
+        if (!c->enabled || !c->ram)
+            continue;
+
+        if (c->type != 1) {
+            fprintf(stderr, "cheats: cheat%u has an unsupported cheat_type %u\n", i, c->type);
+            continue;
+        }
+
+        // Sub-byte values go into the bits of the mask, starting at its lowest.
+        if (c->size < 3) {
+            if (!mask)
+                mask = (1u << (1u << c->size)) - 1;
+            for (b = 0; b < 8 && !(mask & (1u << b)); ++b)
+                ;
+            value <<= b;
+        }
+
+        for (b = 0; b < bytes; ++b) {
+            unsigned shift = 8 * (c->big_endian ? bytes - 1 - b : b);
+
+            if (!add_op(c->address + b, mask >> shift, value >> shift))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+void cheats_apply(void) {
+    const struct cheat_op *op = g_cheats.ops, *end = op + g_cheats.num_ops;
+
+    for (; op != end; ++op)
+        *op->ptr = (*op->ptr & ~op->mask) | op->value;
+}
+
+void cheats_deinit(void) {
+    free(g_cheats.cheats);
+    free(g_cheats.codes);
+    free(g_cheats.ops);
+
+    memset(&g_cheats, 0, sizeof(g_cheats));
+}
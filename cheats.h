@@ -0,0 +1,21 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Loads RetroArch .cht cheat files. Code cheats (cheatN_handler = 0) are
+// handed to the core, RAM cheats (cheatN_handler = 1) are applied by the
+// frontend: they are resolved through the memory map into a flat list of
+// byte writes and replayed after every frame.
+bool cheats_load(const char *path);
+
+// Enabled code cheats, for retro_cheat_set.
+unsigned cheats_code_count(void);
+const char *cheats_code(unsigned index);
+
+// Resolves the RAM cheats, false if one of them is not mapped.
+bool cheats_compile(void);
+
+// Writes the RAM cheats, cheap enough to run every frame.
+void cheats_apply(void);
+
+void cheats_deinit(void);
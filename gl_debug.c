@@ -0,0 +1,92 @@
+#ifdef GL_DEBUG
+#include <stdbool.h>
+#include <stdio.h>
+#include "glad.h"
+#include "gl_debug.h"
+#include "gl_loader.h"
+
+static struct {
+    bool callback;
+    unsigned interval;
+    unsigned frame;
+    bool sampling;
+
+    // Messages are raised from inside the offending call, and reported by
+    // the check that follows it.
+    bool pending;
+    char message[1024];
+} g_debug;
+
+static void APIENTRY debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity,
+                                    GLsizei length, const GLchar *message, const void *user) {
+    if (severity == GL_DEBUG_SEVERITY_NOTIFICATION)
+        return;
+
+    // Keep the first message if several arrive before the next check.
+    if (!g_debug.pending)
+        snprintf(g_debug.message, sizeof(g_debug.message), "%s", message);
+
+    g_debug.pending = true;
+}
+
+void gl_debug_init(unsigned interval) {
+    g_debug.interval = interval ? interval : 1;
+    g_debug.frame = 0;
+    g_debug.sampling = true;
+
+    if (gl_loader_require(GL_FEATURE_DEBUG) && glDebugMessageCallback) {
+        glDebugMessageCallback(debug_callback, NULL);
+        g_debug.callback = true;
+    } else if (GLAD_GL_KHR_debug && glDebugMessageCallbackKHR) {
+        glDebugMessageCallbackKHR(debug_callback, NULL);
+        g_debug.callback = true;
+    }
+
+    if (g_debug.callback) {
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        printf("GL debug: using KHR_debug callbacks\n");
+    } else {
+        printf("GL debug: checking glGetError every %u frames\n", g_debug.interval);
+    }
+}
+
+// Errors raised since the last check, by a HW core or in a frame that was
+// not sampled, are reported here rather than blamed on the next call site.
+void gl_debug_frame(void) {
+    GLenum error;
+
+    if (g_debug.callback) {
+        if (g_debug.pending) {
+            printf("GL error before video_draw: %s\n", g_debug.message);
+            g_debug.pending = false;
+        }
+        return;
+    }
+
+    g_debug.sampling = ++g_debug.frame % g_debug.interval == 0;
+    if (!g_debug.sampling)
+        return;
+
+    while ((error = glGetError()) != GL_NO_ERROR)
+        printf("GL error 0x%x before video_draw\n", error);
+}
+
+void gl_debug_check(const char *file, int line) {
+    GLenum error;
+
+    if (g_debug.callback) {
+        if (g_debug.pending) {
+            printf("GL error at %s:%d: %s\n", file, line, g_debug.message);
+            g_debug.pending = false;
+        }
+        return;
+    }
+
+    if (!g_debug.sampling)
+        return;
+
+    while ((error = glGetError()) != GL_NO_ERROR)
+        printf("GL error 0x%x at %s:%d\n", error, file, line);
+}
+#endif
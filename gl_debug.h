@@ -0,0 +1,18 @@
+#pragma once
+
+// GL debug layer, only compiled in with GL_DEBUG (make DEBUG=1). Errors are
+// reported through KHR_debug callbacks when the driver has them, otherwise
+// glGetError is sampled every <interval> frames since it forces a pipeline
+// sync. Either way the offending call site is reported by file and line.
+// Errors raised outside the checked calls, by a HW core or between two
+// sampled frames, are reported as "before video_draw" when a frame starts.
+#ifdef GL_DEBUG
+void gl_debug_init(unsigned interval);
+void gl_debug_frame(void);
+void gl_debug_check(const char *file, int line);
+#define GL_DEBUG_CHECK() gl_debug_check(__FILE__, __LINE__)
+#else
+#define gl_debug_init(interval) ((void)0)
+#define gl_debug_frame() ((void)0)
+#define GL_DEBUG_CHECK() ((void)0)
+#endif
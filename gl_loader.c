@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <string.h>
+#include "gl_loader.h"
+
+#ifdef GLAD_FULL
+
+bool gl_loader_init(GLADloadproc load, bool gles) {
+    return gles ? gladLoadGLES2Loader(load) : gladLoadGLLoader(load);
+}
+
+bool gl_loader_require(enum gl_feature feature) {
+    switch (feature) {
+    case GL_FEATURE_VAO:
+        return (glGenVertexArrays && glBindVertexArray && glDeleteVertexArrays) ||
+               GLAD_GL_OES_vertex_array_object;
+    case GL_FEATURE_PROGRAM_BINARY:
+        return (glGetProgramBinary && glProgramBinary) || GLAD_GL_OES_get_program_binary;
+    case GL_FEATURE_READBACK:
+        return glFenceSync && glMapBufferRange;
+    case GL_FEATURE_SYNC:
+        return glFenceSync && glClientWaitSync;
+    case GL_FEATURE_DEBUG:
+        return glDebugMessageCallback || (GLAD_GL_KHR_debug && glDebugMessageCallbackKHR);
+    }
+
+    return false;
+}
+
+#else
+
+// Every function the frontend calls on any context. A function missing from
+// here is an undefined glad_ symbol at link time.
+#define GL_BASE(X) \
+    X(PFNGLACTIVETEXTUREPROC, glActiveTexture) \
+    X(PFNGLATTACHSHADERPROC, glAttachShader) \
+    X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+    X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+    X(PFNGLBINDTEXTUREPROC, glBindTexture) \
+    X(PFNGLBUFFERDATAPROC, glBufferData) \
+    X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
+    X(PFNGLCLEARPROC, glClear) \
+    X(PFNGLCLEARCOLORPROC, glClearColor) \
+    X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+    X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+    X(PFNGLCREATESHADERPROC, glCreateShader) \
+    X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+    X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+    X(PFNGLDELETEPROGRAMPROC, glDeleteProgram) \
+    X(PFNGLDELETESHADERPROC, glDeleteShader) \
+    X(PFNGLDELETETEXTURESPROC, glDeleteTextures) \
+    X(PFNGLDISABLEPROC, glDisable) \
+    X(PFNGLDRAWELEMENTSPROC, glDrawElements) \
+    X(PFNGLENABLEPROC, glEnable) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray) \
+    X(PFNGLFRAMEBUFFERTEXTURE2DPROC, glFramebufferTexture2D) \
+    X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+    X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+    X(PFNGLGENTEXTURESPROC, glGenTextures) \
+    X(PFNGLGETATTRIBLOCATIONPROC, glGetAttribLocation) \
+    X(PFNGLGETERRORPROC, glGetError) \
+    X(PFNGLGETINTEGERVPROC, glGetIntegerv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+    X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+    X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+    X(PFNGLGETSTRINGPROC, glGetString) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+    X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+    X(PFNGLPIXELSTOREIPROC, glPixelStorei) \
+    X(PFNGLREADPIXELSPROC, glReadPixels) \
+    X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+    X(PFNGLTEXIMAGE2DPROC, glTexImage2D) \
+    X(PFNGLTEXPARAMETERIPROC, glTexParameteri) \
+    X(PFNGLTEXSUBIMAGE2DPROC, glTexSubImage2D) \
+    X(PFNGLUNIFORM1IPROC, glUniform1i) \
+    X(PFNGLUNIFORM2FPROC, glUniform2f) \
+    X(PFNGLUNIFORMMATRIX4FVPROC, glUniformMatrix4fv) \
+    X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+    X(PFNGLVIEWPORTPROC, glViewport)
+
+#define GL_VAO(X) \
+    X(PFNGLGENVERTEXARRAYSPROC, glGenVertexArrays) \
+    X(PFNGLBINDVERTEXARRAYPROC, glBindVertexArray) \
+    X(PFNGLDELETEVERTEXARRAYSPROC, glDeleteVertexArrays)
+
+#define GL_VAO_OES(X) \
+    X(PFNGLGENVERTEXARRAYSOESPROC, glGenVertexArraysOES) \
+    X(PFNGLBINDVERTEXARRAYOESPROC, glBindVertexArrayOES) \
+    X(PFNGLDELETEVERTEXARRAYSOESPROC, glDeleteVertexArraysOES)
+
+#define GL_PROGRAM_BINARY(X) \
+    X(PFNGLGETPROGRAMBINARYPROC, glGetProgramBinary) \
+    X(PFNGLPROGRAMBINARYPROC, glProgramBinary) \
+    X(PFNGLPROGRAMPARAMETERIPROC, glProgramParameteri)
+
+#define GL_PROGRAM_BINARY_OES(X) \
+    X(PFNGLGETPROGRAMBINARYOESPROC, glGetProgramBinaryOES) \
+    X(PFNGLPROGRAMBINARYOESPROC, glProgramBinaryOES)
+
+#define GL_READBACK(X) \
+    X(PFNGLMAPBUFFERRANGEPROC, glMapBufferRange) \
+    X(PFNGLUNMAPBUFFERPROC, glUnmapBuffer)
+
+#define GL_SYNC(X) \
+    X(PFNGLFENCESYNCPROC, glFenceSync) \
+    X(PFNGLCLIENTWAITSYNCPROC, glClientWaitSync) \
+    X(PFNGLDELETESYNCPROC, glDeleteSync)
+
+#define GL_DEBUG_CORE(X) \
+    X(PFNGLDEBUGMESSAGECALLBACKPROC, glDebugMessageCallback)
+
+#define GL_DEBUG_KHR(X) \
+    X(PFNGLDEBUGMESSAGECALLBACKKHRPROC, glDebugMessageCallbackKHR)
+
+#define GL_DEFINE(type, name) type glad_##name;
+#define GL_ENTRY(type, name) { #name, (void**)&glad_##name },
+
+GL_BASE(GL_DEFINE)
+GL_VAO(GL_DEFINE)
+GL_VAO_OES(GL_DEFINE)
+GL_PROGRAM_BINARY(GL_DEFINE)
+GL_PROGRAM_BINARY_OES(GL_DEFINE)
+GL_READBACK(GL_DEFINE)
+GL_SYNC(GL_DEFINE)
+GL_DEBUG_CORE(GL_DEFINE)
+GL_DEBUG_KHR(GL_DEFINE)
+PFNGLGETSTRINGIPROC glad_glGetStringi;
+
+int GLAD_GL_KHR_debug;
+int GLAD_GL_OES_get_program_binary;
+int GLAD_GL_OES_vertex_array_object;
+
+struct gl_proc {
+    const char *name;
+    void **ptr;
+};
+
+static const struct gl_proc g_base[] = { GL_BASE(GL_ENTRY) };
+static const struct gl_proc g_vao[] = { GL_VAO(GL_ENTRY) };
+static const struct gl_proc g_vao_oes[] = { GL_VAO_OES(GL_ENTRY) };
+static const struct gl_proc g_program_binary[] = { GL_PROGRAM_BINARY(GL_ENTRY) };
+static const struct gl_proc g_program_binary_oes[] = { GL_PROGRAM_BINARY_OES(GL_ENTRY) };
+static const struct gl_proc g_readback[] = { GL_READBACK(GL_ENTRY) };
+static const struct gl_proc g_sync[] = { GL_SYNC(GL_ENTRY) };
+static const struct gl_proc g_debug_core[] = { GL_DEBUG_CORE(GL_ENTRY) };
+static const struct gl_proc g_debug_khr[] = { GL_DEBUG_KHR(GL_ENTRY) };
+
+#define GL_FEATURES (GL_FEATURE_DEBUG + 1)
+
+static struct {
+    GLADloadproc load;
+    bool gles;
+    int major, minor;
+    bool loaded[GL_FEATURES];
+    bool supported[GL_FEATURES];
+} g_loader;
+
+#define GL_AT_LEAST(maj, min) \
+    (g_loader.major > (maj) || (g_loader.major == (maj) && g_loader.minor >= (min)))
+
+static bool load_procs(const struct gl_proc *procs, size_t count) {
+    bool all = true;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        *procs[i].ptr = g_loader.load(procs[i].name);
+        all = all && *procs[i].ptr;
+    }
+
+    return all;
+}
+
+#define LOAD_PROCS(procs) load_procs(procs, sizeof(procs) / sizeof(procs[0]))
+
+// Core profiles have no GL_EXTENSIONS string, only the indexed query.
+static bool has_ext(const char *ext) {
+    size_t len = strlen(ext);
+
+    if (!g_loader.gles && g_loader.major >= 3) {
+        GLint i, count = 0;
+
+        if (!glad_glGetStringi)
+            glad_glGetStringi = (PFNGLGETSTRINGIPROC)g_loader.load("glGetStringi");
+        if (!glad_glGetStringi)
+            return false;
+
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (i = 0; i < count; ++i) {
+            const char *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+
+            if (name && !strcmp(name, ext))
+                return true;
+        }
+        return false;
+    } else {
+        const char *exts = (const char*)glGetString(GL_EXTENSIONS), *at = exts;
+
+        while (at && (at = strstr(at, ext))) {
+            if ((at == exts || at[-1] == ' ') && (at[len] == ' ' || !at[len]))
+                return true;
+            at += len;
+        }
+        return false;
+    }
+}
+
+bool gl_loader_init(GLADloadproc load, bool gles) {
+    static const char *prefixes[] = { "OpenGL ES-CM ", "OpenGL ES-CL ", "OpenGL ES " };
+    const char *version;
+    unsigned i;
+
+    memset(&g_loader, 0, sizeof(g_loader));
+    g_loader.load = load;
+    g_loader.gles = gles;
+
+    LOAD_PROCS(g_base);
+    if (!glGetString || !(version = (const char*)glGetString(GL_VERSION)))
+        return false;
+
+    for (i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); ++i) {
+        if (!strncmp(version, prefixes[i], strlen(prefixes[i]))) {
+            version += strlen(prefixes[i]);
+            break;
+        }
+    }
+
+    return sscanf(version, "%d.%d", &g_loader.major, &g_loader.minor) == 2;
+}
+
+static bool load_feature(enum gl_feature feature) {
+    bool gles = g_loader.gles;
+
+    switch (feature) {
+    case GL_FEATURE_VAO:
+        if (GL_AT_LEAST(3, 0) && LOAD_PROCS(g_vao))
+            return true;
+        GLAD_GL_OES_vertex_array_object = gles && has_ext("GL_OES_vertex_array_object");
+        return GLAD_GL_OES_vertex_array_object && LOAD_PROCS(g_vao_oes);
+    case GL_FEATURE_PROGRAM_BINARY:
+        if ((gles ? GL_AT_LEAST(3, 0) : (GL_AT_LEAST(4, 1) || has_ext("GL_ARB_get_program_binary"))) &&
+            LOAD_PROCS(g_program_binary))
+            return true;
+        GLAD_GL_OES_get_program_binary = gles && has_ext("GL_OES_get_program_binary");
+        return GLAD_GL_OES_get_program_binary && LOAD_PROCS(g_program_binary_oes);
+    case GL_FEATURE_READBACK:
+        return gl_loader_require(GL_FEATURE_SYNC) && LOAD_PROCS(g_readback);
+    case GL_FEATURE_SYNC:
+        return (gles ? GL_AT_LEAST(3, 0) : GL_AT_LEAST(3, 2)) && LOAD_PROCS(g_sync);
+    case GL_FEATURE_DEBUG:
+        GLAD_GL_KHR_debug = has_ext("GL_KHR_debug");
+        // Desktop KHR_debug has no suffix.
+        if ((gles ? GL_AT_LEAST(3, 2) : (GL_AT_LEAST(4, 3) || GLAD_GL_KHR_debug)) && LOAD_PROCS(g_debug_core))
+            return true;
+        return gles && GLAD_GL_KHR_debug && LOAD_PROCS(g_debug_khr);
+    }
+
+    return false;
+}
+
+bool gl_loader_require(enum gl_feature feature) {
+    if (!g_loader.load)
+        return false;
+
+    if (!g_loader.loaded[feature]) {
+        g_loader.supported[feature] = load_feature(feature);
+        g_loader.loaded[feature] = true;
+    }
+
+    return g_loader.supported[feature];
+}
+
+#endif
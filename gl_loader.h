@@ -0,0 +1,27 @@
+#pragma once
+#include <stdbool.h>
+#include "glad.h"
+
+// Resolves only the GL functions the frontend calls, instead of the few
+// thousand entry points and the extension list glad.c loads up front. The
+// base set is loaded by gl_loader_init, optional features on first use.
+// Builds with GLAD_FULL (make GLAD_FULL=1) load everything through glad.c
+// instead, for comparison. Cores get their functions from
+// SDL_GL_GetProcAddress and are not affected either way.
+
+enum gl_feature {
+    GL_FEATURE_VAO,            // vertex array objects, core or OES
+    GL_FEATURE_PROGRAM_BINARY, // program binaries, core or OES
+    GL_FEATURE_READBACK,       // PBO mapping, implies GL_FEATURE_SYNC
+    GL_FEATURE_SYNC,           // fence sync objects
+    GL_FEATURE_DEBUG,          // KHR_debug callbacks
+};
+
+// Needs a current context. Returns false if the context has no glGetString
+// or no version.
+bool gl_loader_init(GLADloadproc load, bool gles);
+
+// Loads the functions of a feature the first time it is asked for. Returns
+// whether the context has the feature, the function pointers stay NULL
+// otherwise.
+bool gl_loader_require(enum gl_feature feature);
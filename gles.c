@@ -4,26 +4,38 @@
 #include <memory.h>
 #include <unistd.h>
 #include <malloc.h>
+#include "gl_debug.h"
+#include "gl_loader.h"
 #include "gles.h"
+#include "shader_cache.h"
+#include "shader_preset.h"
+#include "viewport.h"
 
-static uint32_t frame_width = 0;
-static uint32_t frame_height = 0;
-uint32_t screen_width;
-uint32_t screen_height;
 float m[4][4];
 
-//IMPORTANT, make sure this function is commented out at runtime
-//as it has a big performance impact!
-#define	SHOW_ERROR	gles_show_error();
+// GL calls issued by the current frame, every draw path call is tagged with
+// SHOW_ERROR so the count doubles as a state churn regression check.
+static unsigned gl_calls;
+static unsigned gl_calls_last;
 
+// Set by video_bind, owned by the frontend context being displayed.
+static GVideo *video;
+static SDL_Window *window;
+
+// Error checks compile out unless built with GL_DEBUG, see gl_debug.h.
+#define	SHOW_ERROR	gl_calls++; GL_DEBUG_CHECK();
+
+// u_tex_scale crops the core texture to the visible frame, so geometry
+// changes never touch the vertex buffers.
 static const char* vertex_shader =
     "uniform mat4 u_vp_matrix;                              \n"
+    "uniform vec2 u_tex_scale;                              \n"
     "attribute vec4 a_position;                             \n"
     "attribute vec2 a_texcoord;                             \n"
     "varying mediump vec2 v_texcoord;                       \n"
     "void main()                                            \n"
     "{                                                      \n"
-    "   v_texcoord = a_texcoord;                            \n"
+    "   v_texcoord = a_texcoord * u_tex_scale;              \n"
     "   gl_Position = u_vp_matrix * a_position;             \n"
     "}                                                      \n";
 
@@ -111,8 +123,13 @@ static const GLfloat vertices[] =
 	-0.5f, +0.5f, 0.0f,
 };
 
-//Values defined in gles2_create()
-static GLfloat uvs[8];
+static const GLfloat uvs[8] =
+{
+	0.0f, 0.0f,
+	1.0f, 0.0f,
+	1.0f, 1.0f,
+	0.0f, 1.0f,
+};
 
 static const GLushort indices[] =
 {
@@ -123,22 +140,18 @@ static const GLushort indices[] =
 static const int kVertexCount = 4;
 static const int kIndexCount = 6;
 
-void gles_show_error()
-{
-	GLenum error = GL_NO_ERROR;
-    error = glGetError();
-    if (GL_NO_ERROR != error)
-        printf("GL Error %x encountered!\n", error);
-}
-
 static GLuint CreateShader(GLenum type, const char *shader_src)
 {
 	GLuint shader = glCreateShader(type);
 	if(!shader)
 		return 0;
 
-	// Load and compile the shader source
-	glShaderSource(shader, 1, &shader_src, NULL);
+	// Load and compile the shader source. GLES requires a default float
+	// precision in fragment shaders, the built-in ones don't declare any.
+	const char *sources[2] = { "", shader_src };
+	if (type == GL_FRAGMENT_SHADER)
+		sources[0] = "#ifdef GL_ES\nprecision mediump float;\n#endif\n";
+	glShaderSource(shader, 2, sources, NULL);
 	glCompileShader(shader);
 
 	// Check the compile status
@@ -164,6 +177,10 @@ static GLuint CreateShader(GLenum type, const char *shader_src)
 
 static GLuint CreateProgram(const char *vertex_shader_src, const char *fragment_shader_src)
 {
+	GLuint cached = shader_cache_load(vertex_shader_src, fragment_shader_src);
+	if(cached)
+		return cached;
+
 	GLuint vertex_shader = CreateShader(GL_VERTEX_SHADER, vertex_shader_src);
 	if(!vertex_shader)
 		return 0;
@@ -179,6 +196,7 @@ static GLuint CreateProgram(const char *vertex_shader_src, const char *fragment_
 		return 0;
 	glAttachShader(program_object, vertex_shader);
 	glAttachShader(program_object, fragment_shader);
+	shader_cache_hint(program_object);
 
 	// Link the program
 	glLinkProgram(program_object);
@@ -204,6 +222,7 @@ static GLuint CreateProgram(const char *vertex_shader_src, const char *fragment_
 	// Delete these here because they are attached to the program object.
 	glDeleteShader(vertex_shader);
 	glDeleteShader(fragment_shader);
+	shader_cache_store(program_object, vertex_shader_src, fragment_shader_src);
 	return program_object;
 }
 
@@ -212,22 +231,218 @@ typedef	struct ShaderInfo {
 		GLint a_position;
 		GLint a_texcoord;
 		GLint u_vp_matrix;
+		GLint u_tex_scale;
 		GLint u_texture;
+		GLint u_input_size;
+		GLint u_texture_size;
+		GLint u_output_size;
+
+		// Last uploaded uniform values, programs can be shared by passes.
+		const GLfloat *vp_matrix;
+		GLfloat tex_scale[2];
+		GLfloat input_size[2];
+		GLfloat texture_size[2];
+		GLfloat output_size[2];
 } ShaderInfo;
 
-static ShaderInfo shader;
+typedef struct ShaderPass {
+	ShaderInfo *shader;
+	GLenum filter;
+	enum shader_scale_type scale_type;
+	float scale_x, scale_y;
+	GLuint vao;
+
+	// Render target, unused by the last pass which draws to the screen.
+	GLuint fbo;
+	GLuint tex;
+	GLsizei width, height;
+} ShaderPass;
+
+typedef struct ShaderChain {
+	unsigned count;
+	ShaderPass pass[SHADER_MAX_PASSES];
+} ShaderChain;
+
+#define VIDEO_MAX_SHADERS 16
+#define VIDEO_MAX_PROGRAMS (VIDEO_MAX_SHADERS * SHADER_MAX_PASSES)
+
+static const struct {
+	const char *name;
+	const char **source;
+} builtin_shaders[] = {
+	{ "none",		&fragment_shader_none },
+	{ "scanline",	&fragment_shader_scanline },
+	{ "phosphor",	&fragment_shader_phospher },
+};
+
+// Every program of every preset is compiled up front, so switching presets
+// at runtime only swaps the active chain.
+static struct {
+	char name[256];
+	ShaderInfo info;
+} programs[VIDEO_MAX_PROGRAMS];
+static unsigned program_count;
+
+static struct shader_preset presets[VIDEO_MAX_SHADERS];
+static ShaderChain chains[VIDEO_MAX_SHADERS];
+static unsigned chain_count;
+static unsigned chain_active;
+
+// Positions, texture coordinates and indices of the quad every pass draws.
 static GLuint buffers[3];
-static GLuint textures[2];
 
 static float proj[4][4];
-static float gmw, gmh;
+static float proj_fbo[4][4];
+
+// Output layout, only recomputed when the window, the geometry or the mode
+// changes.
+static struct {
+	enum viewport_mode mode;
+	int screen_w, screen_h;
+	unsigned width, height;
+	float aspect;
+	struct viewport vp;
+	bool valid;
+} layout;
+
+// Vertex array objects, from GLES 3 / GL 3 or GL_OES_vertex_array_object.
+static struct {
+	PFNGLGENVERTEXARRAYSPROC gen;
+	PFNGLBINDVERTEXARRAYPROC bind;
+	PFNGLDELETEVERTEXARRAYSPROC del;
+} vao;
+
+// Mirror of the GL bindings, lets the steady-state frame skip redundant
+// binds. Invalidated whenever code outside video_draw, or a HW rendering
+// core, may have changed them.
+static struct {
+	GLuint program;
+	GLuint texture;
+	GLuint framebuffer;
+	GLuint vao;
+	GLint viewport[4];
+} gl_state;
+
+static void gl_state_invalidate()
+{
+	unsigned i;
+
+	memset(&gl_state, 0xff, sizeof(gl_state));
+
+	for (i = 0; i < program_count; ++i)
+		programs[i].info.vp_matrix = NULL;
+}
+
+static void gl_use_program(GLuint program)
+{
+	if (gl_state.program != program) {
+		glUseProgram(program); SHOW_ERROR
+		gl_state.program = program;
+	}
+}
+
+static void gl_bind_texture(GLuint texture)
+{
+	if (gl_state.texture != texture) {
+		glBindTexture(GL_TEXTURE_2D, texture); SHOW_ERROR
+		gl_state.texture = texture;
+	}
+}
+
+static void gl_bind_framebuffer(GLuint framebuffer)
+{
+	if (gl_state.framebuffer != framebuffer) {
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer); SHOW_ERROR
+		gl_state.framebuffer = framebuffer;
+	}
+}
+
+static void gl_bind_vao(GLuint array)
+{
+	if (gl_state.vao != array) {
+		vao.bind(array); SHOW_ERROR
+		gl_state.vao = array;
+	}
+}
+
+static void gl_viewport(GLint x, GLint y, GLsizei w, GLsizei h)
+{
+	if (gl_state.viewport[0] != x || gl_state.viewport[1] != y || gl_state.viewport[2] != w || gl_state.viewport[3] != h) {
+		glViewport(x, y, w, h); SHOW_ERROR
+		gl_state.viewport[0] = x;
+		gl_state.viewport[1] = y;
+		gl_state.viewport[2] = w;
+		gl_state.viewport[3] = h;
+	}
+}
+
+static void gl_uniform2f(GLint location, GLfloat *cache, GLfloat x, GLfloat y)
+{
+	if (location >= 0 && (cache[0] != x || cache[1] != y)) {
+		glUniform2f(location, x, y); SHOW_ERROR
+		cache[0] = x;
+		cache[1] = y;
+	}
+}
+
+static void video_vao_init()
+{
+	memset(&vao, 0, sizeof(vao));
+
+	if (!gl_loader_require(GL_FEATURE_VAO)) {
+		printf("Vertex array objects unsupported, binding attributes every frame\n");
+	} else if (glGenVertexArrays && glBindVertexArray && glDeleteVertexArrays) {
+		vao.gen = glGenVertexArrays;
+		vao.bind = glBindVertexArray;
+		vao.del = glDeleteVertexArrays;
+	} else if (GLAD_GL_OES_vertex_array_object) {
+		vao.gen = glGenVertexArraysOES;
+		vao.bind = glBindVertexArrayOES;
+		vao.del = glDeleteVertexArraysOES;
+	}
+}
+
+static void video_shader_release_chain(ShaderChain *chain, bool vaos)
+{
+	unsigned i;
+
+	for (i = 0; i < chain->count; ++i) {
+		ShaderPass *pass = &chain->pass[i];
+
+		if (pass->fbo)
+			glDeleteFramebuffers(1, &pass->fbo);
+		if (pass->tex)
+			glDeleteTextures(1, &pass->tex);
+		if (pass->vao && vaos) {
+			vao.del(1, &pass->vao);
+			pass->vao = 0;
+		}
+
+		pass->fbo = 0;
+		pass->tex = 0;
+	}
+}
+
+static void video_shader_release_targets(bool vaos)
+{
+	unsigned i;
+
+	for (i = 0; i < chain_count; ++i)
+		video_shader_release_chain(&chains[i], vaos);
+}
 
 static void gles2_destroy()
 {
-	if(!shader.program)
+	unsigned i;
+
+	if(!program_count)
 		return;
+	video_shader_release_targets(true);
 	glDeleteBuffers(3, buffers); SHOW_ERROR
-	glDeleteProgram(shader.program); SHOW_ERROR
+	for (i = 0; i < program_count; ++i) {
+		glDeleteProgram(programs[i].info.program); SHOW_ERROR
+	}
+	program_count = 0;
 }
 
 void SetOrtho(GLfloat m[4][4], GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat near, GLfloat far, GLfloat scale_x, GLfloat scale_y)
@@ -256,155 +471,685 @@ void ortho2d(float m[4][4], float left, float right, float bottom, float top)
     m[3][1] = -(top + bottom) / (top - bottom);
 }
 
-void video_shader_init()
+static const char *builtin_shader(const char *name)
 {
-	memset(&shader, 0, sizeof(ShaderInfo));
-	shader.program = CreateProgram(vertex_shader, fragment_shader_none);
-	//shader.program = CreateProgram(vertex_shader, fragment_shader);
-	if(shader.program)
-	{
-		shader.a_position	= glGetAttribLocation(shader.program,	"a_position");
-		shader.a_texcoord	= glGetAttribLocation(shader.program,	"a_texcoord");
-		shader.u_vp_matrix	= glGetUniformLocation(shader.program,	"u_vp_matrix");
-		shader.u_texture	= glGetUniformLocation(shader.program,	"u_texture");
+	unsigned i;
+
+	for (i = 0; i < sizeof(builtin_shaders) / sizeof(builtin_shaders[0]); ++i)
+		if (!strcmp(builtin_shaders[i].name, name))
+			return *builtin_shaders[i].source;
+
+	return NULL;
+}
+
+bool video_shader_add(const char *name)
+{
+	struct shader_preset *preset;
+
+	if (chain_count >= VIDEO_MAX_SHADERS) {
+		printf("Too many shader presets, ignoring %s\n", name);
+		return false;
+	}
+
+	preset = &presets[chain_count];
+
+	if (builtin_shader(name)) {
+		memset(preset, 0, sizeof(*preset));
+		preset->passes = 1;
+		snprintf(preset->pass[0].shader, sizeof(preset->pass[0].shader), "%s", name);
+	} else if (!shader_preset_load(name, preset)) {
+		return false;
+	}
+
+	chain_count++;
+	return true;
+}
+
+static ShaderInfo *video_shader_program(const char *name)
+{
+	const char *source = builtin_shader(name);
+	char *file = NULL;
+	ShaderInfo *shader;
+	unsigned i;
+
+	for (i = 0; i < program_count; ++i)
+		if (!strcmp(programs[i].name, name))
+			return &programs[i].info;
+
+	if (!source) {
+		source = file = shader_preset_read_source(name);
+		if (!source) {
+			printf("Failed to read shader %s\n", name);
+			return NULL;
+		}
+	}
+
+	shader = &programs[program_count].info;
+	memset(shader, 0, sizeof(ShaderInfo));
+	shader->program = CreateProgram(vertex_shader, source);
+	free(file);
+
+	if(!shader->program) {
+		printf("Failed to build shader %s\n", name);
+		return NULL;
 	}
-	if(!shader.program) return;
 
-	glUniform1i(shader.u_texture, 0);
+	shader->a_position		= glGetAttribLocation(shader->program,	"a_position");
+	shader->a_texcoord		= glGetAttribLocation(shader->program,	"a_texcoord");
+	shader->u_vp_matrix		= glGetUniformLocation(shader->program,	"u_vp_matrix");
+	shader->u_tex_scale		= glGetUniformLocation(shader->program,	"u_tex_scale");
+	shader->u_texture		= glGetUniformLocation(shader->program,	"u_texture");
+	shader->u_input_size	= glGetUniformLocation(shader->program,	"u_input_size");
+	shader->u_texture_size	= glGetUniformLocation(shader->program,	"u_texture_size");
+	shader->u_output_size	= glGetUniformLocation(shader->program,	"u_output_size");
+
+	glUseProgram(shader->program);
+	glUniform1i(shader->u_texture, 0);
 
 	ortho2d(m, -1, 1, 1, -1);
-    glUniformMatrix4fv(shader.u_vp_matrix, 1, GL_FALSE, (float*)m);
+	glUniformMatrix4fv(shader->u_vp_matrix, 1, GL_FALSE, (float*)m);
+
+	snprintf(programs[program_count].name, sizeof(programs[program_count].name), "%s", name);
+	program_count++;
+
+	return shader;
 }
 
-void video_update_vertices(const struct retro_game_geometry *geom, uint32_t width, uint32_t height)
+void video_shader_init()
 {
-	SDL_GetWindowSize(g_win, &screen_width, &screen_height);
-	printf("screen_width: %d\tscreen_height: %d\r\n", screen_width, screen_height);
-	printf("width: %d\theight: %d\r\n", width, height);
-	printf("max_width: %d\tmax_height: %d\r\n", geom->max_width, geom->max_height);
+	Uint64 start = SDL_GetPerformanceCounter();
+	unsigned i, j;
 
-	float min_u = 0.0f;
-	float max_u = (float)width/geom->max_width;
-	float min_v = 0.0f;
-	float max_v = (float)width/geom->max_width;//(float)height/geom->max_height;
-	//float max_v = (float)height/geom->max_height;
+	if (!chain_count)
+		video_shader_add("none");
 
-	uvs[0] = min_u;
-	uvs[1] = min_v;
-	uvs[2] = max_u;
-	uvs[3] = min_v;
-	uvs[4] = max_u;
-	uvs[5] = max_v;
-	uvs[6] = min_u;
-	uvs[7] = max_v;
+	if (!shader_cache_init())
+		printf("Program binaries unsupported, shaders are compiled on every start\n");
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-	glBufferData(GL_ARRAY_BUFFER, kVertexCount * sizeof(GLfloat) * 2, uvs, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	video_vao_init();
+
+	for (i = 0; i < chain_count; ++i) {
+		const struct shader_preset *preset = &presets[i];
+		ShaderChain *chain = &chains[i];
+
+		memset(chain, 0, sizeof(*chain));
+
+		for (j = 0; j < preset->passes; ++j) {
+			const struct shader_pass_desc *desc = &preset->pass[j];
+			ShaderPass *pass = &chain->pass[j];
+
+			pass->shader = video_shader_program(desc->shader);
+			pass->filter = desc->filter_linear ? GL_LINEAR : GL_NEAREST;
+			pass->scale_type = desc->scale_type;
+			pass->scale_x = desc->scale_x;
+			pass->scale_y = desc->scale_y;
+
+			if (!pass->shader)
+				break;
+		}
+
+		// A preset with a broken pass falls back to a plain copy.
+		if (j == preset->passes) {
+			chain->count = preset->passes;
+		} else {
+			memset(chain, 0, sizeof(*chain));
+			chain->count = 1;
+			chain->pass[0].shader = video_shader_program("none");
+			chain->pass[0].filter = GL_NEAREST;
+		}
+	}
+
+	chain_active = 0;
+
+	printf("Built %u shader programs in %.2f ms\n", program_count,
+		(SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency());
 }
 
-void video_init(const struct retro_game_geometry *geom, uint32_t width, uint32_t height, uint32_t filter)
+static void video_shader_pass_size(const ShaderPass *pass, GLsizei in_w, GLsizei in_h, GLsizei *w, GLsizei *h)
 {
-	printf("video_init\r\n");
-	gmw = geom->max_width;
-	gmh = geom->max_height;
-	float op_zoom = (float)(width)/(float)width;
-	glBindTexture(GL_TEXTURE_2D, g_video.tex_id);
+	switch (pass->scale_type) {
+	case SHADER_SCALE_VIEWPORT:
+		*w = layout.vp.width * pass->scale_x;
+		*h = layout.vp.height * pass->scale_y;
+		break;
+	case SHADER_SCALE_ABSOLUTE:
+		*w = pass->scale_x;
+		*h = pass->scale_y;
+		break;
+	default:
+		*w = in_w * pass->scale_x;
+		*h = in_h * pass->scale_y;
+		break;
+	}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, geom->max_width, geom->max_height, 0, g_video.pixtype, g_video.pixfmt, NULL);
+	if (*w < 1)
+		*w = 1;
+	if (*h < 1)
+		*h = 1;
+}
+
+// The attribute setup of each pass is recorded once, drawing then only
+// needs to bind its VAO. Passes only differ in their attribute locations.
+static void video_shader_pass_vao(ShaderPass *pass)
+{
+	const ShaderInfo *sh = pass->shader;
+
+	if (!vao.gen)
+		return;
+
+	vao.gen(1, &pass->vao);
+	vao.bind(pass->vao);
 
-	glGenBuffers(3, buffers);
 	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
-	glBufferData(GL_ARRAY_BUFFER, kVertexCount * sizeof(GLfloat) * 3, vertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(sh->a_position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL);
+	glEnableVertexAttribArray(sh->a_position);
 
-	video_update_vertices(geom, width, height);
+	glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+	glVertexAttribPointer(sh->a_texcoord, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), NULL);
+	glEnableVertexAttribArray(sh->a_texcoord);
 
-	/*glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
-	glBufferData(GL_ARRAY_BUFFER, kVertexCount * sizeof(GLfloat) * 2, uvs, GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);*/
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, kIndexCount * sizeof(GL_UNSIGNED_SHORT), indices, GL_STATIC_DRAW);
+	vao.bind(0);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+// True if the render targets of every chain already match the current
+// geometry and layout.
+static bool video_shader_targets_valid()
+{
+	unsigned i, j;
+
+	for (i = 0; i < chain_count; ++i) {
+		GLsizei in_w = video->clip_w, in_h = video->clip_h;
+
+		for (j = 0; j + 1 < chains[i].count; ++j) {
+			const ShaderPass *pass = &chains[i].pass[j];
+			GLsizei w, h;
+
+			video_shader_pass_size(pass, in_w, in_h, &w, &h);
+			if (!pass->fbo || w != pass->width || h != pass->height)
+				return false;
+
+			in_w = w;
+			in_h = h;
+		}
+	}
+
+	return true;
+}
+
+// (Re)creates the intermediate render targets of every chain, if any pass
+// size changed.
+static void video_shader_resize()
+{
+	unsigned i, j;
+
+	if (video_shader_targets_valid())
+		return;
+
+	video_shader_release_targets(false);
+
+	for (i = 0; i < chain_count; ++i) {
+		GLsizei in_w = video->clip_w, in_h = video->clip_h;
+
+		for (j = 0; j + 1 < chains[i].count; ++j) {
+			ShaderPass *pass = &chains[i].pass[j];
+
+			video_shader_pass_size(pass, in_w, in_h, &pass->width, &pass->height);
+
+			glGenTextures(1, &pass->tex);
+			glBindTexture(GL_TEXTURE_2D, pass->tex);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, pass->width, pass->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			// Filters are sampler state of the texture read by the next pass.
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, chains[i].pass[j + 1].filter);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, chains[i].pass[j + 1].filter);
+
+			glGenFramebuffers(1, &pass->fbo);
+			glBindFramebuffer(GL_FRAMEBUFFER, pass->fbo);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pass->tex, 0);
+
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				printf("Shader pass %u of preset %u: incomplete framebuffer, disabling preset\n", j, i);
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				video_shader_release_chain(&chains[i], true);
+				chains[i].pass[0] = chains[i].pass[chains[i].count - 1];
+				chains[i].count = 1;
+				video_shader_pass_vao(&chains[i].pass[0]);
+				break;
+			}
+
+			in_w = pass->width;
+			in_h = pass->height;
+		}
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	video_shader_select(chain_active);
+}
+
+void video_shader_select(unsigned index)
+{
+	GLenum filter;
+
+	if (index >= chain_count)
+		return;
+
+	chain_active = index;
+
+	// The core texture is sampled by the first pass of the active chain.
+	filter = chains[chain_active].pass[0].filter;
+	glBindTexture(GL_TEXTURE_2D, video->tex_id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+
+	gl_state_invalidate();
+}
+
+unsigned video_gl_calls()
+{
+	return gl_calls_last;
+}
+
+void video_bind(struct GVideo *v, SDL_Window *w)
+{
+	video = v;
+	window = w;
+}
+
+void video_shader_next()
+{
+	if (chain_count)
+		video_shader_select((chain_active + 1) % chain_count);
+	printf("Shader preset %u of %u\r\n", chain_active + 1, chain_count);
+}
+
+// Recomputes the viewport if any of its inputs changed. Drawing picks the
+// new layout up through the cached uniforms, only render targets scaled by
+// the viewport or the geometry are reallocated.
+static void video_layout_update()
+{
+	int screen_w, screen_h;
+	struct viewport vp;
+
+	SDL_GetWindowSize(window, &screen_w, &screen_h);
+
+	if (layout.valid && layout.screen_w == screen_w && layout.screen_h == screen_h &&
+		layout.width == video->clip_w && layout.height == video->clip_h)
+		return;
+
+	layout.screen_w = screen_w;
+	layout.screen_h = screen_h;
+	layout.width = video->clip_w;
+	layout.height = video->clip_h;
+	layout.valid = true;
+
+	viewport_layout(layout.mode, screen_w, screen_h, layout.width, layout.height, layout.aspect, &vp);
+	if (memcmp(&vp, &layout.vp, sizeof(vp))) {
+		layout.vp = vp;
+		printf("Viewport %dx%d at %d,%d (%s) in a %dx%d window\r\n", vp.width, vp.height, vp.x, vp.y,
+			viewport_mode_name(layout.mode), screen_w, screen_h);
+	}
+
+	video_shader_resize();
+}
+
+void video_set_viewport_mode(enum viewport_mode mode)
+{
+	layout.mode = mode;
+	layout.valid = false;
+	if (buffers[0])
+		video_layout_update();
+}
+
+void video_set_geometry(const struct retro_game_geometry *geom)
+{
+	video->clip_w = geom->base_width;
+	video->clip_h = geom->base_height;
+	if (layout.aspect != geom->aspect_ratio)
+		layout.valid = false;
+	layout.aspect = geom->aspect_ratio;
+	video_layout_update();
+}
+
+void video_window_resized()
+{
+	video_layout_update();
+}
+
+void video_init(const struct retro_game_geometry *geom)
+{
+	unsigned i, j;
+
+	printf("video_init\r\n");
+	glBindTexture(GL_TEXTURE_2D, video->tex_id);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, geom->max_width, geom->max_height, 0, video->pixtype, video->pixfmt, NULL); SHOW_ERROR
+
+	if (!buffers[0]) {
+		glGenBuffers(3, buffers);
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+		glBufferData(GL_ARRAY_BUFFER, kVertexCount * sizeof(GLfloat) * 3, vertices, GL_STATIC_DRAW);
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+		glBufferData(GL_ARRAY_BUFFER, kVertexCount * sizeof(GLfloat) * 2, uvs, GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, kIndexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+		for (i = 0; i < chain_count; ++i)
+			for (j = 0; j < chains[i].count; ++j)
+				video_shader_pass_vao(&chains[i].pass[j]);
+	}
 
 	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
 	glDisable(GL_DEPTH_TEST);
 	glDisable(GL_BLEND);
 	glDisable(GL_DITHER);
+	glActiveTexture(GL_TEXTURE0);
 
-	SDL_GetWindowSize(g_win, &screen_width, &screen_height);
-
-	float sx = 1.0f, sy = 1.0f;
-	int h = geom->max_height;
-	int w = geom->max_width;
-	int rr=(screen_height*10/height);
-	h = (height*rr)/10;
-	w = (width*rr)/10;
-	if (w>screen_width) {
-	    rr = (screen_width*10/width);
-	    h = (height*rr)/10;
-	    w = (width*rr)/10;
-	}
-	glViewport((screen_width-w)/2, (screen_height-h)/2, w, h);
-	//glViewport(0, 0, screen_width, screen_height);
-
-	float a = (float)screen_width/(float)screen_height;
-	float a0 = (float)geom->max_width/(float)geom->max_height;
-	if(a > a0)
-		sx = a0/a;
-	else
-		sy = a/a0;
-	//SetOrtho(proj, -0.5f, +0.5f, +0.5f, -0.5f, -1.0f, 1.0f, sx*op_zoom, sy*op_zoom);
+	// The viewport does the letterboxing, the quad always fills it. Render
+	// targets keep the orientation of the core texture, so only the last
+	// pass flips the image.
 	SetOrtho(proj, -0.5f, +0.5f, +0.5f, -0.5f, -1.0f, 1.0f, 1.0f, 1.0f);
+	SetOrtho(proj_fbo, -0.5f, +0.5f, -0.5f, +0.5f, -1.0f, 1.0f, 1.0f, 1.0f);
+
+	// The texture may have been recreated with another filter.
+	layout.valid = false;
+	video_set_geometry(geom);
+	video_shader_select(chain_active);
+}
+
+// Hard GPU sync keeps a fence per drawn frame, tagged with the time the
+// frame started and so read its input. Measuring alone still needs a slot
+// per frame the driver may queue.
+#define GPU_SYNC_SLOTS 8
+static struct {
+	int frames;
+	GLsync fences[GPU_SYNC_SLOTS];
+	Uint64 started[GPU_SYNC_SLOTS];
+	unsigned first, count;
+	Uint64 frame_start;
+	struct video_sync_stats stats;
+} gpu_sync = { VIDEO_GPU_SYNC_OFF };
+
+bool video_set_gpu_sync(int frames)
+{
+	if (frames > VIDEO_GPU_SYNC_MAX || frames < VIDEO_GPU_SYNC_OFF)
+		return false;
+	if (frames != VIDEO_GPU_SYNC_OFF && !gl_loader_require(GL_FEATURE_SYNC))
+		return false;
+
+	gpu_sync.frames = frames;
+	return true;
+}
+
+// Drops the oldest fence once it signaled, or once a blocking wait on it
+// failed. Returns whether it signaled.
+static bool gpu_sync_retire(GLuint64 timeout)
+{
+	unsigned slot = gpu_sync.first;
+	Uint64 now, t0 = SDL_GetPerformanceCounter();
+	GLenum status;
+	bool signaled;
+	double ms;
+
+	status = glClientWaitSync(gpu_sync.fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, timeout); SHOW_ERROR
+	now = SDL_GetPerformanceCounter();
+	signaled = status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED;
+	if (timeout)
+		gpu_sync.stats.wait_ms += (now - t0) * 1000.0 / SDL_GetPerformanceFrequency();
+	if (!timeout && status == GL_TIMEOUT_EXPIRED)
+		return false;
+
+	// A fence found signaled without waiting signaled at most this late.
+	if (signaled) {
+		ms = (now - gpu_sync.started[slot]) * 1000.0 / SDL_GetPerformanceFrequency();
+		gpu_sync.stats.frames++;
+		gpu_sync.stats.latency_ms += ms;
+		if (ms > gpu_sync.stats.max_latency_ms)
+			gpu_sync.stats.max_latency_ms = ms;
+	}
+
+	glDeleteSync(gpu_sync.fences[slot]); SHOW_ERROR
+	gpu_sync.first = (slot + 1) % GPU_SYNC_SLOTS;
+	gpu_sync.count--;
+	return signaled;
+}
+
+void video_gpu_sync()
+{
+	unsigned limit = gpu_sync.frames >= 0 ? (unsigned)gpu_sync.frames : GPU_SYNC_SLOTS - 1;
+
+	if (gpu_sync.frames == VIDEO_GPU_SYNC_OFF)
+		return;
+
+	// Collect what finished on its own, then wait for the frame from N
+	// frames ago, or for a free slot when only measuring.
+	while (gpu_sync.count && gpu_sync_retire(0))
+		;
+	while (gpu_sync.count > limit)
+		gpu_sync_retire(1000000000);
+
+	gpu_sync.frame_start = SDL_GetPerformanceCounter();
+}
+
+static void gpu_sync_fence()
+{
+	unsigned slot = (gpu_sync.first + gpu_sync.count) % GPU_SYNC_SLOTS;
+
+	if (gpu_sync.frames == VIDEO_GPU_SYNC_OFF || gpu_sync.count == GPU_SYNC_SLOTS)
+		return;
+
+	gpu_sync.fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); SHOW_ERROR
+	if (!gpu_sync.fences[slot])
+		return;
+	gpu_sync.started[slot] = gpu_sync.frame_start;
+	gpu_sync.count++;
+}
+
+static void gpu_sync_release()
+{
+	while (gpu_sync.count) {
+		glDeleteSync(gpu_sync.fences[gpu_sync.first]); SHOW_ERROR
+		gpu_sync.first = (gpu_sync.first + 1) % GPU_SYNC_SLOTS;
+		gpu_sync.count--;
+	}
+}
+
+void video_gpu_sync_stats(struct video_sync_stats *stats)
+{
+	*stats = gpu_sync.stats;
+}
+
+// The core's HW framebuffer is read into a pixel pack buffer and a fence
+// tells when the copy has landed, so the frame never waits for the GPU.
+static struct {
+	GLuint pbo;
+	GLsync fence;
+	GLsizeiptr size;
+	bool mapped;
+} readback;
+
+static void video_readback_release()
+{
+	if (readback.fence)
+		glDeleteSync(readback.fence);
+	if (readback.pbo)
+		glDeleteBuffers(1, &readback.pbo);
+	memset(&readback, 0, sizeof(readback));
 }
 
 void video_close()
 {
+	gpu_sync_release();
+	video_readback_release();
 	gles2_destroy();
 }
 
-static void gles2_DrawQuad(const ShaderInfo *sh)
+bool video_readback_start(unsigned width, unsigned height)
 {
-	glUniform1i(sh->u_texture, 0); SHOW_ERROR
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST); SHOW_ERROR 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST); SHOW_ERROR
+	GLsizeiptr size = (GLsizeiptr)width * height * 4;
+
+	// PBOs and fences need GLES 3.0, they are only loaded by the first shot.
+	if (readback.fence || !gl_loader_require(GL_FEATURE_READBACK))
+		return false;
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffers[0]); SHOW_ERROR
-	glVertexAttribPointer(sh->a_position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL); SHOW_ERROR
-	glEnableVertexAttribArray(sh->a_position); SHOW_ERROR
+	if (!readback.pbo) {
+		glGenBuffers(1, &readback.pbo); SHOW_ERROR
+	}
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo); SHOW_ERROR
+	if (size > readback.size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ); SHOW_ERROR
+		readback.size = size;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, buffers[1]); SHOW_ERROR
-	glVertexAttribPointer(sh->a_texcoord, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), NULL); SHOW_ERROR
-	glEnableVertexAttribArray(sh->a_texcoord); SHOW_ERROR
+	gl_bind_framebuffer(video->fbo_id);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL); SHOW_ERROR
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0); SHOW_ERROR
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); SHOW_ERROR
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]); SHOW_ERROR
+	return readback.fence != NULL;
+}
+
+const void *video_readback_map(bool wait)
+{
+	GLenum status;
+	void *data;
+
+	if (!readback.fence)
+		return NULL;
+
+	status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000 : 0); SHOW_ERROR
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return NULL;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo); SHOW_ERROR
+	data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, readback.size, GL_MAP_READ_BIT); SHOW_ERROR
+	readback.mapped = data != NULL;
+	if (!data)
+		video_readback_end();
+
+	return data;
+}
+
+void video_readback_end()
+{
+	if (readback.mapped) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.pbo); SHOW_ERROR
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER); SHOW_ERROR
+		readback.mapped = false;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0); SHOW_ERROR
+
+	if (readback.fence) {
+		glDeleteSync(readback.fence); SHOW_ERROR
+		readback.fence = NULL;
+	}
+}
+
+static void gles2_DrawQuad(const ShaderPass *pass)
+{
+	const ShaderInfo *sh = pass->shader;
+
+	if (pass->vao) {
+		gl_bind_vao(pass->vao);
+	} else {
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[0]); SHOW_ERROR
+		glVertexAttribPointer(sh->a_position, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), NULL); SHOW_ERROR
+		glEnableVertexAttribArray(sh->a_position); SHOW_ERROR
+
+		glBindBuffer(GL_ARRAY_BUFFER, buffers[1]); SHOW_ERROR
+		glVertexAttribPointer(sh->a_texcoord, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(GLfloat), NULL); SHOW_ERROR
+		glEnableVertexAttribArray(sh->a_texcoord); SHOW_ERROR
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers[2]); SHOW_ERROR
+	}
 
 	glDrawElements(GL_TRIANGLES, kIndexCount, GL_UNSIGNED_SHORT, 0); SHOW_ERROR
 }
 
 void video_draw(const void *pixels, unsigned width, unsigned height, unsigned pitch)
 {
-	if(!shader.program)
+	const ShaderChain *chain = &chains[chain_active];
+	GLuint source = video->tex_id;
+	GLfloat in_w = video->clip_w, in_h = video->clip_h;
+	GLfloat tex_w = video->tex_w, tex_h = video->tex_h;
+	bool hw_frame = pixels == RETRO_HW_FRAME_BUFFER_VALID;
+	unsigned i;
+
+	if(!program_count || !chain->count)
 		return;
 
-	if (pitch != g_video.pitch) {
-		g_video.pitch = pitch;
-		glPixelStorei(GL_UNPACK_ROW_LENGTH, g_video.pitch / g_video.bpp);
+	gl_calls = 0;
+	gl_debug_frame();
+
+	// A HW rendering core may have changed any state since the last frame.
+	if (hw_frame)
+		gl_state_invalidate();
+
+	if (pitch != video->pitch) {
+		video->pitch = pitch;
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, video->pitch / video->bpp); SHOW_ERROR
 	}
+
+	gl_bind_framebuffer(0);
 	glClear(GL_COLOR_BUFFER_BIT); SHOW_ERROR
 
-	glDisable(GL_BLEND); SHOW_ERROR
-	glUseProgram(shader.program); SHOW_ERROR
-	glUniformMatrix4fv(shader.u_vp_matrix, 1, GL_FALSE, &proj[0][0]); SHOW_ERROR
+	gl_bind_texture(video->tex_id);
+	if (pixels && !hw_frame) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, video->pixtype, video->pixfmt, pixels); SHOW_ERROR
+		//glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (int)(width-height)/2, width, height, video->pixtype, video->pixfmt, pixels);
+	}
+
+	for (i = 0; i < chain->count; ++i) {
+		const ShaderPass *pass = &chain->pass[i];
+		ShaderInfo *sh = pass->shader;
+		bool last = i + 1 == chain->count;
+		const GLfloat *matrix = last ? &proj[0][0] : &proj_fbo[0][0];
 
-	glActiveTexture(GL_TEXTURE0); SHOW_ERROR
-	glBindTexture(GL_TEXTURE_2D, g_video.tex_id); SHOW_ERROR
-	if (pixels && pixels != RETRO_HW_FRAME_BUFFER_VALID) {
-		//printf("%d %d\r\n", (int)(width-gmw)/2, (int)(height-gmh)/2);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, g_video.pixtype, g_video.pixfmt, pixels);
-		//glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (int)(width-height)/2, width, height, g_video.pixtype, g_video.pixfmt, pixels);
+		if (last) {
+			gl_bind_framebuffer(0);
+			gl_viewport(layout.vp.x, layout.vp.y, layout.vp.width, layout.vp.height);
+		} else {
+			gl_bind_framebuffer(pass->fbo);
+			gl_viewport(0, 0, pass->width, pass->height);
+		}
+
+		gl_use_program(sh->program);
+		if (sh->vp_matrix != matrix) {
+			glUniformMatrix4fv(sh->u_vp_matrix, 1, GL_FALSE, matrix); SHOW_ERROR
+			sh->vp_matrix = matrix;
+		}
+		gl_uniform2f(sh->u_tex_scale, sh->tex_scale, in_w / tex_w, in_h / tex_h);
+		gl_uniform2f(sh->u_input_size, sh->input_size, in_w, in_h);
+		gl_uniform2f(sh->u_texture_size, sh->texture_size, tex_w, tex_h);
+		gl_uniform2f(sh->u_output_size, sh->output_size, last ? layout.vp.width : pass->width, last ? layout.vp.height : pass->height);
+
+		gl_bind_texture(source);
+		gles2_DrawQuad(pass);
+
+		source = pass->tex;
+		in_w = tex_w = pass->width;
+		in_h = tex_h = pass->height;
+	}
+
+	// Leave no buffers bound for a HW rendering core, it may rely on
+	// client-side arrays.
+	if (hw_frame || !vao.bind) {
+		if (vao.bind)
+			gl_bind_vao(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0); SHOW_ERROR
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); SHOW_ERROR
 	}
-	gles2_DrawQuad(&shader);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0); SHOW_ERROR
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); SHOW_ERROR
-}
\ No newline at end of file
+	gpu_sync_fence();
+	gl_calls_last = gl_calls;
+}
@@ -2,6 +2,7 @@
 #include <SDL.h>
 #include "glad.h"
 #include "libretro.h"
+#include "viewport.h"
 typedef struct GVideo {
 	GLuint tex_id;
     GLuint fbo_id;
@@ -21,7 +22,6 @@ typedef struct GVideo {
 
     struct retro_hw_render_callback hw;
 } GVideo;
-extern struct GVideo g_video;
 
 
 
@@ -37,28 +37,76 @@ typedef struct GRetro {
 	void (*retro_set_controller_port_device)(unsigned port, unsigned device);
 	void (*retro_reset)(void);
 	void (*retro_run)(void);
-//	size_t retro_serialize_size(void);
-//	bool retro_serialize(void *data, size_t size);
-//	bool retro_unserialize(const void *data, size_t size);
-//	void retro_cheat_reset(void);
-//	void retro_cheat_set(unsigned index, bool enabled, const char *code);
+	size_t (*retro_serialize_size)(void);
+	bool (*retro_serialize)(void *data, size_t size);
+	bool (*retro_unserialize)(const void *data, size_t size);
+	void (*retro_cheat_reset)(void);
+	void (*retro_cheat_set)(unsigned index, bool enabled, const char *code);
 	bool (*retro_load_game)(const struct retro_game_info *game);
 //	bool retro_load_game_special(unsigned game_type, const struct retro_game_info *info, size_t num_info);
 	void (*retro_unload_game)(void);
 //	unsigned retro_get_region(void);
-//	void *retro_get_memory_data(unsigned id);
-//	size_t retro_get_memory_size(unsigned id);
-} GRetro;
-extern struct GRetro g_retro;
+	void *(*retro_get_memory_data)(unsigned id);
+	size_t (*retro_get_memory_size)(unsigned id);
 
-extern SDL_Window *g_win;
+	void (*retro_set_environment)(retro_environment_t);
+	void (*retro_set_video_refresh)(retro_video_refresh_t);
+	void (*retro_set_input_poll)(retro_input_poll_t);
+	void (*retro_set_input_state)(retro_input_state_t);
+	void (*retro_set_audio_sample)(retro_audio_sample_t);
+	void (*retro_set_audio_sample_batch)(retro_audio_sample_batch_t);
+} GRetro;
 
 
 void SetOrtho(GLfloat m[4][4], GLfloat left, GLfloat right, GLfloat bottom, GLfloat top, GLfloat near, GLfloat far, GLfloat scale_x, GLfloat scale_y);
 void ortho2d(float m[4][4], float left, float right, float bottom, float top);
 
+// Registers a shader preset file or a built-in shader (none, scanline,
+// phosphor). Must be called before video_shader_init, the first one added
+// is active by default.
+bool video_shader_add(const char *name);
 void video_shader_init();
-void video_init(const struct retro_game_geometry *geom, uint32_t width,uint32_t height, uint32_t f);
+void video_shader_select(unsigned index);
+void video_shader_next();
+// Number of GL calls issued by the last video_draw.
+unsigned video_gl_calls();
+// The core texture and window the video_ functions draw with, set once the
+// window and its GL context exist.
+void video_bind(struct GVideo *video, SDL_Window *window);
+void video_init(const struct retro_game_geometry *geom);
+// Geometry changes within the max size only update the layout, the core
+// texture is kept.
+void video_set_geometry(const struct retro_game_geometry *geom);
+void video_set_viewport_mode(enum viewport_mode mode);
+void video_window_resized();
 void video_close();
 void video_draw(const void *pixels, unsigned width, unsigned height, unsigned pitch);
+
+// Asynchronous RGBA readback of the core's HW framebuffer, bottom row first.
+// Returns false without GLES 3.0 or while a readback is still pending.
+bool video_readback_start(unsigned width, unsigned height);
+// NULL until the GPU finished the copy, or within a second with wait set.
+// A mapped readback must be released with video_readback_end.
+const void *video_readback_map(bool wait);
+void video_readback_end();
+
+// Hard GPU sync: video_draw ends with a fence, and video_gpu_sync, called
+// before each retro_run, waits until at most <frames> drawn frames are still
+// unfinished, so the driver cannot queue further ahead. 0 finishes every
+// frame before the next starts, VIDEO_GPU_SYNC_MEASURE only times the
+// fences. Returns false without fence support.
+#define VIDEO_GPU_SYNC_OFF -2
+#define VIDEO_GPU_SYNC_MEASURE -1
+#define VIDEO_GPU_SYNC_MAX 3
+bool video_set_gpu_sync(int frames);
+void video_gpu_sync();
+
+// Time from the start of a frame to the GPU finishing its draw, as seen
+// by video_gpu_sync, and the time it spent waiting.
+struct video_sync_stats {
+	unsigned frames;
+	double latency_ms, max_latency_ms;
+	double wait_ms;
+};
+void video_gpu_sync_stats(struct video_sync_stats *stats);
 //void video_set_filter(uint32_t filter);
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "golden.h"
+
+static struct {
+    FILE *fp;
+    bool write;
+
+    uint64_t *hashes;
+    size_t count;
+
+    size_t frame;
+    unsigned mismatches;
+} g_golden;
+
+bool golden_open(const char *path, bool write) {
+    uint64_t frame, vh, ah;
+    size_t cap = 0;
+
+    memset(&g_golden, 0, sizeof(g_golden));
+    g_golden.write = write;
+
+    g_golden.fp = fopen(path, write ? "w" : "r");
+    if (!g_golden.fp) {
+        fprintf(stderr, "golden: failed to open %s\n", path);
+        return false;
+    }
+
+    if (write)
+        return true;
+
+    while (fscanf(g_golden.fp, "%" SCNu64 " %" SCNx64 " %" SCNx64, &frame, &vh, &ah) == 3) {
+        if (frame != g_golden.count) {
+            fprintf(stderr, "golden: %s is out of order at frame %zu\n", path, g_golden.count);
+            goto fail;
+        }
+
+        if (g_golden.count * 2 + 2 > cap) {
+            uint64_t *hashes;
+
+            cap = cap ? cap * 2 : 2048;
+            hashes = realloc(g_golden.hashes, cap * sizeof(*g_golden.hashes));
+            if (!hashes)
+                goto fail;
+            g_golden.hashes = hashes;
+        }
+
+        g_golden.hashes[g_golden.count * 2 + 0] = vh;
+        g_golden.hashes[g_golden.count * 2 + 1] = ah;
+        g_golden.count++;
+    }
+
+    fclose(g_golden.fp);
+    g_golden.fp = NULL;
+    return true;
+
+fail:
+    fclose(g_golden.fp);
+    free(g_golden.hashes);
+    memset(&g_golden, 0, sizeof(g_golden));
+    return false;
+}
+
+bool golden_frame(uint64_t video_hash, uint64_t audio_hash) {
+    size_t frame = g_golden.frame++;
+
+    if (g_golden.write) {
+        if (g_golden.fp)
+            fprintf(g_golden.fp, "%zu %016" PRIx64 " %016" PRIx64 "\n", frame, video_hash, audio_hash);
+        return true;
+    }
+
+    if (frame >= g_golden.count) {
+        g_golden.mismatches++;
+        return false;
+    }
+
+    if (g_golden.hashes[frame * 2 + 0] != video_hash || g_golden.hashes[frame * 2 + 1] != audio_hash) {
+        if (g_golden.mismatches < 10)
+            fprintf(stderr, "golden: frame %zu mismatch (video %016" PRIx64 "/%016" PRIx64 ", audio %016" PRIx64 "/%016" PRIx64 ")\n",
+                frame, video_hash, g_golden.hashes[frame * 2 + 0], audio_hash, g_golden.hashes[frame * 2 + 1]);
+        g_golden.mismatches++;
+        return false;
+    }
+
+    return true;
+}
+
+unsigned golden_close(size_t *missing) {
+    unsigned mismatches = g_golden.mismatches;
+
+    if (g_golden.fp && fclose(g_golden.fp)) {
+        fprintf(stderr, "golden: failed to write the golden file\n");
+        mismatches++;
+    }
+
+    *missing = !g_golden.write && g_golden.frame < g_golden.count ? g_golden.count - g_golden.frame : 0;
+
+    free(g_golden.hashes);
+    memset(&g_golden, 0, sizeof(g_golden));
+    return mismatches;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Golden files hold one "<frame> <video hash> <audio hash>" line per frame.
+// In write mode every frame is appended, otherwise each frame is compared
+// against the stored hashes.
+bool golden_open(const char *path, bool write);
+
+// Returns false if the frame does not match the golden file.
+bool golden_frame(uint64_t video_hash, uint64_t audio_hash);
+
+// Returns the number of mismatched frames, frames past the end of the file
+// included. Frames of the file the run never reached go to <missing>.
+unsigned golden_close(size_t *missing);
@@ -0,0 +1,28 @@
+#include <string.h>
+#include "hash.h"
+
+#define HASH_PRIME 0x100000001b3ULL
+
+uint64_t hash64(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *p = (const uint8_t*)data;
+    uint64_t h = seed;
+
+    while (len >= 8) {
+        uint64_t v;
+        memcpy(&v, p, sizeof(v));
+        h = (h ^ v) * HASH_PRIME;
+        h ^= h >> 29;
+        p += 8;
+        len -= 8;
+    }
+
+    while (len--)
+        h = (h ^ *p++) * HASH_PRIME;
+
+    // Final avalanche so that short inputs still spread over all bits.
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    return h;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+// Fast non-cryptographic 64-bit hash, processes 8 bytes per step. Stable
+// across runs and hosts of the same endianness, so it can be stored on disk.
+uint64_t hash64(const void *data, size_t len, uint64_t seed);
+
+// Folds a 64-bit hash into 32 bits for compact storage.
+static inline uint32_t hash_fold32(uint64_t h) {
+    return (uint32_t)(h ^ (h >> 32));
+}
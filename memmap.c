@@ -0,0 +1,337 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "memmap.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define MEMMAP_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define MEMMAP_NEON
+#endif
+
+#define PAGE_BITS 10
+#define LEAF_BITS 10
+#define LEAF_SHIFT (PAGE_BITS + LEAF_BITS)
+#define LEAF_PAGES (1u << LEAF_BITS)
+// Page entries hold a descriptor index + 1, 0 for unmapped pages.
+#define PAGE_MIXED 0xffff
+
+struct desc {
+    uint8_t *ptr;
+    size_t offset, start, select, disconnect, len;
+};
+
+struct watch {
+    size_t addr, len;
+    const uint8_t *host;
+    size_t shadow; // offset into the shadow arena
+};
+
+static struct {
+    struct desc *descs;
+    unsigned num_descs;
+    size_t space_mask;
+    uint16_t **leaves;
+    size_t num_leaves;
+
+    struct watch *watches;
+    unsigned num_watches;
+    uint8_t *shadow;
+    size_t shadow_size;
+} g_mmap;
+
+static size_t mask_below(size_t v) {
+    v |= v >> 1;
+    v |= v >> 2;
+    v |= v >> 4;
+    v |= v >> 8;
+    v |= v >> 16;
+#if SIZE_MAX > 0xffffffff
+    v |= v >> 32;
+#endif
+    return v;
+}
+
+static size_t highest_bit(size_t v) {
+    v = mask_below(v);
+    return v ^ (v >> 1);
+}
+
+// Squeezes out the disconnected address lines.
+// Highest line first, so the lower ones keep their place.
+static size_t remove_bits(size_t v, size_t mask) {
+    while (mask) {
+        size_t bit = highest_bit(mask);
+
+        v = (v & (bit - 1)) | ((v >> 1) & ~(bit - 1));
+        mask ^= bit;
+    }
+
+    return v;
+}
+
+static uint8_t *translate(const struct desc *d, size_t addr) {
+    size_t off = addr - d->start;
+
+    if (!d->ptr)
+        return NULL;
+    if (d->disconnect)
+        off = remove_bits(off, d->disconnect);
+    while (d->len && off >= d->len)
+        off &= ~highest_bit(off);
+
+    return d->ptr + d->offset + off;
+}
+
+static void free_index(void) {
+    size_t i;
+
+    for (i = 0; i < g_mmap.num_leaves; ++i)
+        free(g_mmap.leaves[i]);
+    free(g_mmap.leaves);
+    free(g_mmap.descs);
+
+    g_mmap.leaves = NULL;
+    g_mmap.num_leaves = 0;
+    g_mmap.descs = NULL;
+    g_mmap.num_descs = 0;
+}
+
+void memmap_deinit(void) {
+    free_index();
+    free(g_mmap.watches);
+    free(g_mmap.shadow);
+
+    memset(&g_mmap, 0, sizeof(g_mmap));
+}
+
+// Entry of the page at base: the descriptor that claims all of it, or
+// PAGE_MIXED when the first one to claim any of it only takes a part.
+static uint16_t classify(size_t base, size_t span) {
+    unsigned i;
+
+    for (i = 0; i < g_mmap.num_descs; ++i) {
+        const struct desc *d = &g_mmap.descs[i];
+
+        if ((base ^ d->start) & d->select & ~(span - 1))
+            continue;
+        return d->select & (span - 1) ? PAGE_MIXED : i + 1;
+    }
+
+    return 0;
+}
+
+static bool build_index(void) {
+    size_t top = 0, t;
+    unsigned i, p;
+
+    for (i = 0; i < g_mmap.num_descs; ++i) {
+        const struct desc *d = &g_mmap.descs[i];
+        top |= d->start | d->select | (d->len ? d->start + d->len - 1 : 0);
+    }
+    g_mmap.space_mask = mask_below(top);
+
+    if (g_mmap.space_mask > 0xffffffff) {
+        fprintf(stderr, "memmap: address space wider than 32 bits\n");
+        return false;
+    }
+
+    // Descriptors without a select claim an aligned power of two block.
+    for (i = 0; i < g_mmap.num_descs; ++i) {
+        struct desc *d = &g_mmap.descs[i];
+
+        if (!d->select && d->len)
+            d->select = g_mmap.space_mask & ~mask_below(d->len - 1);
+        d->select &= g_mmap.space_mask;
+        d->disconnect &= g_mmap.space_mask;
+    }
+
+    g_mmap.num_leaves = (g_mmap.space_mask >> LEAF_SHIFT) + 1;
+    g_mmap.leaves = calloc(g_mmap.num_leaves, sizeof(*g_mmap.leaves));
+    if (!g_mmap.leaves)
+        return false;
+
+    // Only the megabytes that something claims get a leaf.
+    for (t = 0; t < g_mmap.num_leaves; ++t) {
+        size_t base = t << LEAF_SHIFT;
+
+        if (!classify(base, (size_t)1 << LEAF_SHIFT))
+            continue;
+
+        if (!(g_mmap.leaves[t] = calloc(LEAF_PAGES, sizeof(uint16_t))))
+            return false;
+        for (p = 0; p < LEAF_PAGES; ++p)
+            g_mmap.leaves[t][p] = classify(base + ((size_t)p << PAGE_BITS), (size_t)1 << PAGE_BITS);
+    }
+
+    return true;
+}
+
+bool memmap_set(const struct retro_memory_map *map) {
+    unsigned i;
+
+    // Watches keep their host pointers, a core may set its map again.
+    free_index();
+
+    if (map->num_descriptors >= PAGE_MIXED)
+        return false;
+
+    g_mmap.descs = calloc(map->num_descriptors ? map->num_descriptors : 1, sizeof(*g_mmap.descs));
+    if (!g_mmap.descs)
+        return false;
+
+    for (i = 0; i < map->num_descriptors; ++i) {
+        const struct retro_memory_descriptor *src = &map->descriptors[i];
+        struct desc *d;
+
+        if (src->addrspace && src->addrspace[0])
+            continue;
+
+        d = &g_mmap.descs[g_mmap.num_descs++];
+        d->ptr = src->ptr;
+        d->offset = src->offset;
+        d->start = src->start;
+        d->select = src->select;
+        d->disconnect = src->disconnect;
+        d->len = src->len;
+    }
+
+    if (!build_index()) {
+        free_index();
+        return false;
+    }
+
+    return true;
+}
+
+bool memmap_set_ram(void *data, size_t size) {
+    struct retro_memory_descriptor desc = { 0 };
+    struct retro_memory_map map = { &desc, 1 };
+
+    if (!data || !size)
+        return false;
+
+    desc.ptr = data;
+    desc.len = size;
+    return memmap_set(&map);
+}
+
+bool memmap_active(void) {
+    return g_mmap.leaves != NULL;
+}
+
+uint8_t *memmap_lookup(size_t addr) {
+    const uint16_t *leaf;
+    unsigned i, e;
+
+    if (!g_mmap.leaves || addr > g_mmap.space_mask || !(leaf = g_mmap.leaves[addr >> LEAF_SHIFT]))
+        return NULL;
+
+    e = leaf[(addr >> PAGE_BITS) & (LEAF_PAGES - 1)];
+    if (e != PAGE_MIXED)
+        return e ? translate(&g_mmap.descs[e - 1], addr) : NULL;
+
+    for (i = 0; i < g_mmap.num_descs; ++i)
+        if (!((addr ^ g_mmap.descs[i].start) & g_mmap.descs[i].select))
+            return translate(&g_mmap.descs[i], addr);
+
+    return NULL;
+}
+
+bool memmap_read(size_t addr, void *dst, size_t len) {
+    uint8_t *out = dst;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        const uint8_t *p = memmap_lookup(addr + i);
+
+        if (!p)
+            return false;
+        out[i] = *p;
+    }
+
+    return true;
+}
+
+int memmap_watch(size_t addr, size_t len) {
+    const uint8_t *host = memmap_lookup(addr);
+    struct watch *watches;
+    uint8_t *shadow;
+    size_t i;
+
+    if (!host || !len)
+        return -1;
+    for (i = 1; i < len; ++i)
+        if (memmap_lookup(addr + i) != host + i)
+            return -1;
+
+    watches = realloc(g_mmap.watches, (g_mmap.num_watches + 1) * sizeof(*watches));
+    if (!watches)
+        return -1;
+    g_mmap.watches = watches;
+
+    shadow = realloc(g_mmap.shadow, g_mmap.shadow_size + len);
+    if (!shadow)
+        return -1;
+    g_mmap.shadow = shadow;
+
+    watches[g_mmap.num_watches].addr = addr;
+    watches[g_mmap.num_watches].len = len;
+    watches[g_mmap.num_watches].host = host;
+    watches[g_mmap.num_watches].shadow = g_mmap.shadow_size;
+    memcpy(shadow + g_mmap.shadow_size, host, len);
+    g_mmap.shadow_size += len;
+
+    return (int)g_mmap.num_watches++;
+}
+
+// Compares whole vectors without branching, watches rarely change so
+// there is little to gain from stopping at the first difference.
+static bool differs(const uint8_t *a, const uint8_t *b, size_t n) {
+    size_t i = 0;
+#if defined(MEMMAP_SSE2)
+    __m128i eq = _mm_set1_epi8(-1);
+
+    for (; i + 16 <= n; i += 16)
+        eq = _mm_and_si128(eq, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                              _mm_loadu_si128((const __m128i*)(b + i))));
+    if (_mm_movemask_epi8(eq) != 0xffff)
+        return true;
+#elif defined(MEMMAP_NEON)
+    uint8x16_t eq = vdupq_n_u8(0xff);
+    uint8x8_t half;
+
+    for (; i + 16 <= n; i += 16)
+        eq = vandq_u8(eq, vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    half = vand_u8(vget_low_u8(eq), vget_high_u8(eq));
+    if (vget_lane_u64(vreinterpret_u64_u8(half), 0) != ~(uint64_t)0)
+        return true;
+#endif
+
+    for (; i < n; ++i)
+        if (a[i] != b[i])
+            return true;
+
+    return false;
+}
+
+unsigned memmap_check(memmap_watch_cb cb) {
+    unsigned i, changed = 0;
+
+    for (i = 0; i < g_mmap.num_watches; ++i) {
+        const struct watch *w = &g_mmap.watches[i];
+        uint8_t *shadow = g_mmap.shadow + w->shadow;
+
+        if (!differs(shadow, w->host, w->len))
+            continue;
+
+        if (cb)
+            cb(i, w->addr, w->len, shadow, w->host);
+        memcpy(shadow, w->host, w->len);
+        changed++;
+    }
+
+    return changed;
+}
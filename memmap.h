@@ -0,0 +1,38 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "libretro.h"
+
+// Translates emulated addresses to the core's memory through the
+// descriptors of SET_MEMORY_MAPS, or a single system RAM block at address 0
+// when the core only implements retro_get_memory_data. Only the unnamed
+// address space is indexed.
+//
+// The index is a two-level page table of 1 KiB pages. Pages claimed by a
+// single descriptor resolve in constant time, pages shared by descriptors
+// with a finer select fall back to scanning them in order.
+
+bool memmap_set(const struct retro_memory_map *map);
+bool memmap_set_ram(void *data, size_t size);
+bool memmap_active(void);
+
+// Host pointer of one emulated byte, NULL for unmapped or open bus.
+uint8_t *memmap_lookup(size_t addr);
+
+// Copies len bytes from consecutive emulated addresses, false if any of
+// them is unmapped.
+bool memmap_read(size_t addr, void *dst, size_t len);
+
+// Watchpoints compare their bytes against a shadow copy after every
+// memmap_check. A watch has to be backed by contiguous host memory.
+typedef void (*memmap_watch_cb)(unsigned id, size_t addr, size_t len, const uint8_t *old, const uint8_t *now);
+
+// Returns the watch id, or -1 if the range is unmapped or not contiguous.
+int memmap_watch(size_t addr, size_t len);
+
+// Reports each watch that changed since the last check and updates its
+// shadow copy. Returns the number of watches that changed.
+unsigned memmap_check(memmap_watch_cb cb);
+
+void memmap_deinit(void);
@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "hash.h"
+#include "movie.h"
+
+// File layout (all integers little endian):
+//
+//   char[4] "SDLM", u32 version, u32 anchor, u32 frames, u32 runs,
+//   u32 state size, state bytes,
+//   runs x { varint frame count, varint input XOR previous input },
+//   frames x { u32 video hash, u32 audio hash }
+//
+// Inputs rarely change between frames, so each run stores how many frames
+// share an input and the bits that flipped relative to the run before it.
+
+#define MOVIE_MAGIC "SDLM"
+#define MOVIE_VERSION 1
+#define MOVIE_HEADER_SIZE 24
+
+struct movie_run {
+    uint32_t count;
+    uint16_t input;
+};
+
+static struct {
+    enum movie_mode mode;
+    enum movie_anchor anchor;
+    char *path;
+
+    uint8_t *state;
+    size_t state_size;
+
+    struct movie_run *runs;
+    size_t run_count;
+    size_t run_cap;
+
+    // Playback expands the runs to one input per frame.
+    uint16_t *inputs;
+    uint32_t *hashes;
+    size_t frame_count;
+    size_t frame_cap;
+
+    size_t frame;
+    uint32_t mismatches;
+    int64_t first_mismatch;
+} g_movie;
+
+static void *grow(void *ptr, size_t *cap, size_t need, size_t elem) {
+    size_t ncap = *cap ? *cap : 1024;
+
+    if (need <= *cap)
+        return ptr;
+
+    while (ncap < need)
+        ncap *= 2;
+
+    ptr = realloc(ptr, ncap * elem);
+    if (!ptr) {
+        fprintf(stderr, "movie: out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    *cap = ncap;
+    return ptr;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void put_varint(FILE *fp, uint32_t v) {
+    while (v >= 0x80) {
+        fputc((v & 0x7f) | 0x80, fp);
+        v >>= 7;
+    }
+    fputc(v, fp);
+}
+
+static bool get_varint(const uint8_t **p, const uint8_t *end, uint32_t *v) {
+    unsigned shift = 0;
+
+    *v = 0;
+    while (*p < end && shift < 32) {
+        uint8_t b = *(*p)++;
+        *v |= (uint32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+        shift += 7;
+    }
+
+    return false;
+}
+
+static void movie_reset(void) {
+    free(g_movie.path);
+    free(g_movie.state);
+    free(g_movie.runs);
+    free(g_movie.inputs);
+    free(g_movie.hashes);
+    memset(&g_movie, 0, sizeof(g_movie));
+    g_movie.first_mismatch = -1;
+}
+
+bool movie_record_begin(const char *path, enum movie_anchor anchor, const void *state, size_t state_size) {
+    movie_reset();
+
+    g_movie.path = strdup(path);
+    g_movie.anchor = anchor;
+
+    if (anchor == MOVIE_ANCHOR_STATE) {
+        if (!state || !state_size) {
+            fprintf(stderr, "movie: core did not provide a savestate to anchor to\n");
+            return false;
+        }
+
+        g_movie.state = malloc(state_size);
+        if (!g_movie.state)
+            return false;
+
+        memcpy(g_movie.state, state, state_size);
+        g_movie.state_size = state_size;
+    }
+
+    g_movie.mode = MOVIE_RECORD;
+    return true;
+}
+
+bool movie_playback_begin(const char *path) {
+    const uint8_t *p, *end;
+    uint8_t *data = NULL;
+    uint32_t frames, runs;
+    uint16_t input = 0;
+    size_t size, i, frame = 0;
+    long len;
+
+    FILE *fp = fopen(path, "rb");
+
+    movie_reset();
+
+    if (!fp) {
+        fprintf(stderr, "movie: failed to open %s\n", path);
+        return false;
+    }
+
+    fseek(fp, 0, SEEK_END);
+    len = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    if (len < MOVIE_HEADER_SIZE || !(data = malloc(len)) || fread(data, 1, len, fp) != (size_t)len)
+        goto fail;
+
+    size = len;
+    end = data + size;
+
+    if (memcmp(data, MOVIE_MAGIC, 4) || get_u32(data + 4) != MOVIE_VERSION)
+        goto fail;
+
+    g_movie.anchor = get_u32(data + 8);
+    frames = get_u32(data + 12);
+    runs = get_u32(data + 16);
+    g_movie.state_size = get_u32(data + 20);
+
+    p = data + MOVIE_HEADER_SIZE;
+    if (g_movie.state_size > (size_t)(end - p))
+        goto fail;
+
+    if (g_movie.state_size) {
+        g_movie.state = malloc(g_movie.state_size);
+        if (!g_movie.state)
+            goto fail;
+        memcpy(g_movie.state, p, g_movie.state_size);
+        p += g_movie.state_size;
+    }
+
+    g_movie.inputs = malloc((frames ? frames : 1) * sizeof(*g_movie.inputs));
+    g_movie.hashes = malloc((frames ? frames : 1) * 2 * sizeof(*g_movie.hashes));
+    if (!g_movie.inputs || !g_movie.hashes)
+        goto fail;
+
+    for (i = 0; i < runs; ++i) {
+        uint32_t count, delta;
+
+        if (!get_varint(&p, end, &count) || !get_varint(&p, end, &delta))
+            goto fail;
+
+        if (count > frames - frame)
+            goto fail;
+
+        input ^= delta;
+        while (count--)
+            g_movie.inputs[frame++] = input;
+    }
+
+    if (frame != frames || (size_t)(end - p) < (size_t)frames * 8)
+        goto fail;
+
+    for (i = 0; i < (size_t)frames * 2; ++i, p += 4)
+        g_movie.hashes[i] = get_u32(p);
+
+    g_movie.frame_count = frames;
+    g_movie.mode = MOVIE_PLAYBACK;
+
+    free(data);
+    fclose(fp);
+    return true;
+
+fail:
+    fprintf(stderr, "movie: %s is not a valid movie file\n", path);
+    free(data);
+    fclose(fp);
+    movie_reset();
+    return false;
+}
+
+enum movie_mode movie_get_mode(void) {
+    return g_movie.mode;
+}
+
+enum movie_anchor movie_get_anchor(void) {
+    return g_movie.anchor;
+}
+
+const void *movie_get_state(size_t *size) {
+    *size = g_movie.state_size;
+    return g_movie.state;
+}
+
+uint16_t movie_input(void) {
+    if (g_movie.mode != MOVIE_PLAYBACK || g_movie.frame >= g_movie.frame_count)
+        return 0;
+
+    return g_movie.inputs[g_movie.frame];
+}
+
+bool movie_frame_end(uint16_t input, uint64_t video_hash, uint64_t audio_hash) {
+    uint32_t vh = hash_fold32(video_hash);
+    uint32_t ah = hash_fold32(audio_hash);
+
+    switch (g_movie.mode) {
+    case MOVIE_RECORD: {
+        struct movie_run *last = g_movie.run_count ? &g_movie.runs[g_movie.run_count - 1] : NULL;
+
+        if (last && last->input == input) {
+            last->count++;
+        } else {
+            g_movie.runs = grow(g_movie.runs, &g_movie.run_cap, g_movie.run_count + 1, sizeof(*g_movie.runs));
+            g_movie.runs[g_movie.run_count].count = 1;
+            g_movie.runs[g_movie.run_count].input = input;
+            g_movie.run_count++;
+        }
+
+        g_movie.hashes = grow(g_movie.hashes, &g_movie.frame_cap, (g_movie.frame + 1) * 2, sizeof(*g_movie.hashes));
+        g_movie.hashes[g_movie.frame * 2 + 0] = vh;
+        g_movie.hashes[g_movie.frame * 2 + 1] = ah;
+        g_movie.frame++;
+        return true;
+    }
+    case MOVIE_PLAYBACK:
+        if (g_movie.frame >= g_movie.frame_count)
+            return false;
+
+        if (g_movie.hashes[g_movie.frame * 2 + 0] != vh || g_movie.hashes[g_movie.frame * 2 + 1] != ah) {
+            if (g_movie.first_mismatch < 0)
+                g_movie.first_mismatch = g_movie.frame;
+            g_movie.mismatches++;
+        }
+
+        return ++g_movie.frame < g_movie.frame_count;
+    default:
+        return true;
+    }
+}
+
+static bool movie_write(void) {
+    uint8_t header[MOVIE_HEADER_SIZE];
+    uint16_t prev = 0;
+    size_t i;
+    bool ok;
+
+    FILE *fp = fopen(g_movie.path, "wb");
+    if (!fp) {
+        fprintf(stderr, "movie: failed to create %s\n", g_movie.path);
+        return false;
+    }
+
+    memcpy(header, MOVIE_MAGIC, 4);
+    put_u32(header + 4, MOVIE_VERSION);
+    put_u32(header + 8, g_movie.anchor);
+    put_u32(header + 12, g_movie.frame);
+    put_u32(header + 16, g_movie.run_count);
+    put_u32(header + 20, g_movie.state_size);
+    fwrite(header, 1, sizeof(header), fp);
+
+    if (g_movie.state_size)
+        fwrite(g_movie.state, 1, g_movie.state_size, fp);
+
+    for (i = 0; i < g_movie.run_count; ++i) {
+        put_varint(fp, g_movie.runs[i].count);
+        put_varint(fp, g_movie.runs[i].input ^ prev);
+        prev = g_movie.runs[i].input;
+    }
+
+    for (i = 0; i < g_movie.frame * 2; ++i) {
+        uint8_t buf[4];
+        put_u32(buf, g_movie.hashes[i]);
+        fwrite(buf, 1, sizeof(buf), fp);
+    }
+
+    ok = !ferror(fp);
+    ok = !fclose(fp) && ok;
+
+    if (!ok)
+        fprintf(stderr, "movie: failed to write %s\n", g_movie.path);
+
+    return ok;
+}
+
+bool movie_finish(struct movie_stats *stats) {
+    bool ok = true;
+
+    if (g_movie.mode == MOVIE_RECORD)
+        ok = movie_write();
+
+    if (stats) {
+        stats->frames = g_movie.frame;
+        stats->mismatches = g_movie.mismatches;
+        stats->first_mismatch = g_movie.first_mismatch;
+    }
+
+    movie_reset();
+    return ok;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+enum movie_mode {
+    MOVIE_OFF,
+    MOVIE_RECORD,
+    MOVIE_PLAYBACK,
+};
+
+enum movie_anchor {
+    MOVIE_ANCHOR_RESET = 0, // starts from a power-on reset
+    MOVIE_ANCHOR_STATE = 1, // starts from an embedded savestate
+};
+
+struct movie_stats {
+    uint32_t frames;
+    uint32_t mismatches;
+    int64_t first_mismatch; // -1 when every frame matched
+};
+
+// Starts recording to path. For MOVIE_ANCHOR_STATE the serialized core state
+// is copied into the movie and restored before playback.
+bool movie_record_begin(const char *path, enum movie_anchor anchor, const void *state, size_t state_size);
+bool movie_playback_begin(const char *path);
+
+enum movie_mode movie_get_mode(void);
+enum movie_anchor movie_get_anchor(void);
+const void *movie_get_state(size_t *size);
+
+// Input bitmask (bit n = RETRO_DEVICE_ID_JOYPAD n) of the current frame.
+uint16_t movie_input(void);
+
+// Closes the current frame. Records input and hashes, or in playback compares
+// the hashes against the movie. Returns false once playback ran out of frames.
+bool movie_frame_end(uint16_t input, uint64_t video_hash, uint64_t audio_hash);
+
+// Flushes a recording to disk and releases the movie, filling in stats.
+bool movie_finish(struct movie_stats *stats);
@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <SDL.h>
+#include "netplay.h"
+
+#define NETPLAY_MAGIC 0x504e4453 // "SDNP"
+// magic, ack, first frame, count, then count little endian inputs
+#define HEADER_SIZE 14
+// Holds every frame that can be in flight between the two sides.
+#define INPUT_RING 256
+#define TIMEOUT_MS 5000
+
+static struct {
+    struct netplay_config config;
+    struct netplay_core core;
+    int fd;
+    struct sockaddr_in addr; // the remote side
+
+    uint64_t frame;       // next frame to run
+    uint64_t local_end;   // local input is known below this frame
+    uint64_t remote_end;  // remote input is confirmed below this frame
+    uint64_t peer_ack;    // the remote has our input below this frame
+    uint64_t first_wrong; // earliest frame run on a wrong guess
+    uint16_t local[INPUT_RING];
+    uint16_t remote[INPUT_RING];
+    uint16_t used[INPUT_RING]; // remote input each frame ran with
+
+    // Savestates taken before every frame that ran on a guess, by frame.
+    uint8_t *states;
+    unsigned num_states;
+
+    bool heard;
+    bool told_waiting;
+    Uint32 last_recv;
+    struct netplay_stats stats;
+} g_net = { .fd = -1 };
+
+static void put_u16(uint8_t *p, uint16_t v) {
+    p[0] = v;
+    p[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    put_u16(p, v);
+    put_u16(p + 2, v >> 16);
+}
+
+static uint16_t get_u16(const uint8_t *p) {
+    return p[0] | p[1] << 8;
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+static void *state_slot(uint64_t frame) {
+    return g_net.states + (frame % g_net.num_states) * g_net.core.state_size;
+}
+
+// Unconfirmed frames assume the remote kept its last input.
+static uint16_t remote_input(uint64_t frame) {
+    if (frame < g_net.remote_end)
+        return g_net.remote[frame % INPUT_RING];
+    return g_net.remote_end ? g_net.remote[(g_net.remote_end - 1) % INPUT_RING] : 0;
+}
+
+// Sends every input the remote has not acknowledged yet, so a lost packet
+// is covered by the next one.
+static void send_input(void) {
+    uint8_t packet[HEADER_SIZE + INPUT_RING * 2];
+    uint64_t first = g_net.peer_ack, frame;
+    size_t n = HEADER_SIZE;
+
+    if (g_net.local_end - first > INPUT_RING)
+        first = g_net.local_end - INPUT_RING;
+
+    put_u32(packet, NETPLAY_MAGIC);
+    put_u32(packet + 4, (uint32_t)g_net.remote_end);
+    put_u32(packet + 8, (uint32_t)first);
+    put_u16(packet + 12, (uint16_t)(g_net.local_end - first));
+    for (frame = first; frame < g_net.local_end; ++frame, n += 2)
+        put_u16(packet + n, g_net.local[frame % INPUT_RING]);
+
+    // Losses are covered by the next send.
+    (void)sendto(g_net.fd, packet, n, 0, (const struct sockaddr*)&g_net.addr, sizeof(g_net.addr));
+}
+
+static void receive(void) {
+    uint8_t packet[HEADER_SIZE + INPUT_RING * 2];
+    struct sockaddr_in from;
+    socklen_t from_len;
+    ssize_t len;
+
+    for (;;) {
+        uint64_t ack, first, frame;
+        unsigned count, i;
+
+        from_len = sizeof(from);
+        len = recvfrom(g_net.fd, packet, sizeof(packet), 0, (struct sockaddr*)&from, &from_len);
+        if (len < 0 && errno == EINTR)
+            continue;
+        if (len < 0)
+            return;
+
+        if (len < HEADER_SIZE || get_u32(packet) != NETPLAY_MAGIC ||
+            from.sin_addr.s_addr != g_net.addr.sin_addr.s_addr || from.sin_port != g_net.addr.sin_port)
+            continue;
+
+        ack = get_u32(packet + 4);
+        first = get_u32(packet + 8);
+        count = get_u16(packet + 12);
+        if (HEADER_SIZE + count * 2 > (size_t)len)
+            continue;
+
+        g_net.heard = true;
+        g_net.last_recv = SDL_GetTicks();
+        if (ack > g_net.peer_ack && ack <= g_net.local_end)
+            g_net.peer_ack = ack;
+
+        for (i = 0; i < count; ++i) {
+            uint16_t input = get_u16(packet + HEADER_SIZE + i * 2);
+
+            frame = first + i;
+            if (frame < g_net.remote_end)
+                continue;
+            if (frame > g_net.remote_end)
+                break;
+
+            g_net.remote[frame % INPUT_RING] = input;
+            if (frame < g_net.frame && input != g_net.used[frame % INPUT_RING] && frame < g_net.first_wrong)
+                g_net.first_wrong = frame;
+            g_net.remote_end++;
+        }
+    }
+}
+
+static void wait_readable(int ms) {
+    struct pollfd pfd = { g_net.fd, POLLIN, 0 };
+
+    poll(&pfd, 1, ms);
+}
+
+static bool run_frame(uint64_t frame, bool replay) {
+    uint16_t input[NETPLAY_PLAYERS];
+    unsigned player = g_net.config.player;
+
+    // Frames running on a guess may have to be redone from here.
+    if (frame >= g_net.remote_end && !g_net.core.serialize(state_slot(frame), g_net.core.state_size)) {
+        fprintf(stderr, "netplay: the core failed to save its state\n");
+        return false;
+    }
+
+    input[player] = g_net.local[frame % INPUT_RING];
+    input[!player] = remote_input(frame);
+    g_net.used[frame % INPUT_RING] = input[!player];
+    g_net.core.run(input, replay);
+    return true;
+}
+
+static bool rollback(void) {
+    uint64_t frame = g_net.first_wrong;
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    unsigned depth;
+    double ms;
+
+    if (frame >= g_net.frame)
+        return true;
+
+    depth = (unsigned)(g_net.frame - frame);
+    g_net.first_wrong = UINT64_MAX;
+    if (!g_net.core.unserialize(state_slot(frame), g_net.core.state_size)) {
+        fprintf(stderr, "netplay: the core failed to restore frame %llu\n", (unsigned long long)frame);
+        return false;
+    }
+
+    for (; frame < g_net.frame; ++frame)
+        if (!run_frame(frame, true))
+            return false;
+
+    ms = (SDL_GetPerformanceCounter() - t0) * 1000.0 / SDL_GetPerformanceFrequency();
+    g_net.stats.rollbacks++;
+    g_net.stats.resim_frames += depth;
+    g_net.stats.resim_ms += ms;
+    if (depth > g_net.stats.max_depth)
+        g_net.stats.max_depth = depth;
+    if (ms > g_net.stats.max_resim_ms)
+        g_net.stats.max_resim_ms = ms;
+    return true;
+}
+
+bool netplay_open(const struct netplay_config *config, const struct netplay_core *core) {
+    struct addrinfo hints, *res = NULL;
+    struct sockaddr_in local;
+    char port[8];
+
+    netplay_close();
+
+    if (config->player >= NETPLAY_PLAYERS || config->delay > NETPLAY_MAX_DELAY ||
+        config->window > NETPLAY_MAX_WINDOW || !core->state_size)
+        return false;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(port, sizeof(port), "%u", config->remote_port);
+    if (getaddrinfo(config->remote_host, port, &hints, &res) || !res) {
+        fprintf(stderr, "netplay: cannot resolve %s\n", config->remote_host);
+        return false;
+    }
+    memcpy(&g_net.addr, res->ai_addr, sizeof(g_net.addr));
+    freeaddrinfo(res);
+
+    memset(&local, 0, sizeof(local));
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = htonl(INADDR_ANY);
+    local.sin_port = htons(config->local_port);
+
+    g_net.fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (g_net.fd < 0 || bind(g_net.fd, (struct sockaddr*)&local, sizeof(local)) < 0 ||
+        fcntl(g_net.fd, F_SETFL, fcntl(g_net.fd, F_GETFL) | O_NONBLOCK) < 0) {
+        fprintf(stderr, "netplay: cannot use UDP port %u: %s\n", config->local_port, strerror(errno));
+        netplay_close();
+        return false;
+    }
+
+    g_net.num_states = config->window + 1;
+    g_net.states = malloc(g_net.num_states * core->state_size);
+    if (!g_net.states) {
+        netplay_close();
+        return false;
+    }
+
+    g_net.config = *config;
+    g_net.core = *core;
+    // Both sides start with <delay> frames of no input.
+    g_net.local_end = g_net.remote_end = g_net.peer_ack = config->delay;
+    g_net.first_wrong = UINT64_MAX;
+    return true;
+}
+
+int netplay_frame(uint16_t local_input) {
+    uint64_t frame = g_net.frame;
+
+    // The first call for a frame decides its input, later ones only retry.
+    if (g_net.local_end <= frame + g_net.config.delay) {
+        g_net.local[(frame + g_net.config.delay) % INPUT_RING] = local_input;
+        g_net.local_end = frame + g_net.config.delay + 1;
+    }
+
+    receive();
+    send_input();
+
+    // Too far ahead of the remote, let it catch up.
+    if (frame >= g_net.remote_end + g_net.config.window) {
+        g_net.stats.waits++;
+        if (!g_net.heard && !g_net.told_waiting) {
+            printf("netplay: waiting for %s:%u\r\n", g_net.config.remote_host, g_net.config.remote_port);
+            g_net.told_waiting = true;
+        }
+        if (g_net.heard && SDL_GetTicks() - g_net.last_recv > TIMEOUT_MS) {
+            fprintf(stderr, "netplay: the remote stopped answering\n");
+            return -1;
+        }
+        wait_readable(1);
+        return 0;
+    }
+
+    if (!rollback() || !run_frame(frame, false))
+        return -1;
+
+    g_net.frame++;
+    g_net.stats.frames++;
+    return 1;
+}
+
+bool netplay_finish(void) {
+    Uint32 start = SDL_GetTicks();
+    int i;
+
+    while (g_net.remote_end < g_net.frame || g_net.peer_ack < g_net.frame) {
+        if (SDL_GetTicks() - start > TIMEOUT_MS) {
+            fprintf(stderr, "netplay: the remote did not confirm the last frames\n");
+            return false;
+        }
+        send_input();
+        wait_readable(1);
+        receive();
+    }
+
+    // Our last acknowledgement lets the remote finish too.
+    for (i = 0; i < 3; ++i)
+        send_input();
+
+    return rollback();
+}
+
+void netplay_get_stats(struct netplay_stats *stats) {
+    *stats = g_net.stats;
+}
+
+void netplay_close(void) {
+    if (g_net.fd >= 0)
+        close(g_net.fd);
+    free(g_net.states);
+
+    memset(&g_net, 0, sizeof(g_net));
+    g_net.fd = -1;
+}
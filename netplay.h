@@ -0,0 +1,59 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Two player rollback netplay over UDP. Every frame both sides send their
+// pad bitmask for the frame <delay> frames ahead, and the remote input is
+// predicted to stay unchanged until it arrives. A wrong guess restores the
+// savestate of the first mispredicted frame and runs the frames up to the
+// current one again with output suppressed. Savestates are kept in a ring
+// allocated up front, rolling back allocates nothing.
+
+#define NETPLAY_PLAYERS 2
+// Upper bounds, so the input rings can hold every unacknowledged frame.
+#define NETPLAY_MAX_DELAY 16
+#define NETPLAY_MAX_WINDOW 32
+
+struct netplay_config {
+    uint16_t local_port;
+    const char *remote_host;
+    uint16_t remote_port;
+    unsigned player; // 0 or 1, the pad the local input drives
+    unsigned delay;  // frames between reading and using an input
+    unsigned window; // frames that may run ahead of the remote input
+};
+
+struct netplay_core {
+    size_t state_size;
+    bool (*serialize)(void *data, size_t size);
+    bool (*unserialize)(const void *data, size_t size);
+    // Runs one frame with the given pads, without any output when replaying.
+    void (*run)(const uint16_t input[NETPLAY_PLAYERS], bool replay);
+};
+
+struct netplay_stats {
+    uint64_t frames;       // frames run for real
+    uint64_t rollbacks;
+    uint64_t resim_frames; // frames run again
+    unsigned max_depth;    // frames undone by the deepest rollback
+    double resim_ms;       // time spent restoring and resimulating
+    double max_resim_ms;   // slowest single rollback
+    uint64_t waits;        // netplay_frame calls waiting for the remote
+};
+
+bool netplay_open(const struct netplay_config *config, const struct netplay_core *core);
+
+// Sends the local input and runs the next frame, rolling back first if
+// remote input arrived that was predicted wrong. Returns 1 once a frame ran,
+// 0 when the remote is too far behind and nothing ran (after waiting up to a
+// millisecond for it), and -1 when the remote went silent.
+int netplay_frame(uint16_t local_input);
+
+// Waits until both sides have the input of every frame run so far and
+// corrects the last predicted frames, so both end in the same state.
+// Returns false if the remote does not answer.
+bool netplay_finish(void);
+
+void netplay_get_stats(struct netplay_stats *stats);
+void netplay_close(void);
@@ -0,0 +1,108 @@
+#include <string.h>
+#include "pacing.h"
+
+// Frames looked at by the automatic delay, two seconds at 60 fps.
+#define PACING_HISTORY 120
+// Left between the end of a frame and the vblank, covers sleep overshoot.
+#define PACING_MARGIN_MS 2.0
+
+static const char *swap_names[] = {
+    [SWAP_VSYNC]    = "vsync",
+    [SWAP_OFF]      = "off",
+    [SWAP_ADAPTIVE] = "adaptive",
+};
+
+static struct {
+    double period_ms;
+    unsigned fps;
+    bool automatic;
+    unsigned delay;
+
+    double work[PACING_HISTORY];
+    unsigned next, count;
+    unsigned since_raise;
+
+    struct pacing_stats stats;
+} g_pacing;
+
+bool pacing_parse_swap(const char *name, enum swap_policy *policy) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(swap_names) / sizeof(swap_names[0]); ++i) {
+        if (!strcmp(name, swap_names[i])) {
+            *policy = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *pacing_swap_name(enum swap_policy policy) {
+    return swap_names[policy];
+}
+
+void pacing_init(double fps, int delay_ms) {
+    memset(&g_pacing, 0, sizeof(g_pacing));
+    if (fps <= 0)
+        fps = 60.0;
+
+    g_pacing.period_ms = 1000.0 / fps;
+    g_pacing.fps = (unsigned)(fps + 0.5);
+    g_pacing.automatic = delay_ms < 0;
+    // Start without delay, the automatic one first needs run times.
+    g_pacing.delay = g_pacing.automatic ? 0 : (unsigned)delay_ms;
+    g_pacing.stats.min_delay = ~0u;
+}
+
+unsigned pacing_delay(void) {
+    return g_pacing.delay;
+}
+
+static void tune(void) {
+    double worst = 0, target;
+    unsigned i;
+
+    for (i = 0; i < g_pacing.count; ++i)
+        if (g_pacing.work[i] > worst)
+            worst = g_pacing.work[i];
+
+    target = g_pacing.period_ms - PACING_MARGIN_MS - worst;
+    if (target < 0)
+        target = 0;
+
+    if (target < g_pacing.delay) {
+        g_pacing.delay = (unsigned)target;
+        g_pacing.since_raise = 0;
+    } else if (++g_pacing.since_raise >= g_pacing.fps && target >= g_pacing.delay + 1) {
+        g_pacing.delay++;
+        g_pacing.since_raise = 0;
+    }
+}
+
+void pacing_frame(double work_ms) {
+    struct pacing_stats *stats = &g_pacing.stats;
+
+    stats->frames++;
+    stats->delay_ms += g_pacing.delay;
+    if (g_pacing.delay < stats->min_delay)
+        stats->min_delay = g_pacing.delay;
+    if (g_pacing.delay > stats->max_delay)
+        stats->max_delay = g_pacing.delay;
+    if (g_pacing.delay + work_ms > g_pacing.period_ms)
+        stats->late++;
+
+    g_pacing.work[g_pacing.next] = work_ms;
+    g_pacing.next = (g_pacing.next + 1) % PACING_HISTORY;
+    if (g_pacing.count < PACING_HISTORY)
+        g_pacing.count++;
+
+    if (g_pacing.automatic)
+        tune();
+}
+
+void pacing_get_stats(struct pacing_stats *stats) {
+    *stats = g_pacing.stats;
+    if (!stats->frames)
+        stats->min_delay = 0;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <stdbool.h>
+
+enum swap_policy {
+    SWAP_VSYNC,    // wait for every vblank
+    SWAP_OFF,      // never wait, may tear
+    SWAP_ADAPTIVE, // wait, but swap late frames at once and tear instead
+};
+
+// Accepts "vsync", "off" or "adaptive".
+bool pacing_parse_swap(const char *name, enum swap_policy *policy);
+const char *pacing_swap_name(enum swap_policy policy);
+
+// Frame delay: after the swap returned at a vblank, the frontend sleeps
+// for pacing_delay() ms before running the core, so input is read closer to
+// the next vblank. A negative delay is tuned automatically to leave a small
+// margin after the slowest frame of the last two seconds. It drops at once
+// after a slow frame and rises by 1 ms per second.
+void pacing_init(double fps, int delay_ms);
+unsigned pacing_delay(void);
+
+// Reports the time from the end of the delay to the swap of a frame, the
+// core run and the draw.
+void pacing_frame(double work_ms);
+
+struct pacing_stats {
+    unsigned frames;
+    unsigned late;        // frames whose work did not fit before the vblank
+    unsigned min_delay, max_delay;
+    double delay_ms;      // sum over all frames
+};
+void pacing_get_stats(struct pacing_stats *stats);
@@ -0,0 +1,57 @@
+#include "pixels.h"
+
+unsigned pixels_bpp(enum retro_pixel_format format) {
+    return format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+void pixels_to_rgb24(uint8_t *dst, const void *src, unsigned width, enum retro_pixel_format format) {
+    unsigned x;
+
+    switch (format) {
+    case RETRO_PIXEL_FORMAT_XRGB8888: {
+        const uint32_t *p = src;
+
+        for (x = 0; x < width; ++x, dst += 3) {
+            dst[0] = p[x] >> 16;
+            dst[1] = p[x] >> 8;
+            dst[2] = p[x];
+        }
+        break;
+    }
+    case RETRO_PIXEL_FORMAT_RGB565: {
+        const uint16_t *p = src;
+
+        // Replicate the top bits so full intensity maps to 255.
+        for (x = 0; x < width; ++x, dst += 3) {
+            unsigned r = p[x] >> 11, g = (p[x] >> 5) & 0x3f, b = p[x] & 0x1f;
+
+            dst[0] = (r << 3) | (r >> 2);
+            dst[1] = (g << 2) | (g >> 4);
+            dst[2] = (b << 3) | (b >> 2);
+        }
+        break;
+    }
+    default: {
+        const uint16_t *p = src;
+
+        for (x = 0; x < width; ++x, dst += 3) {
+            unsigned r = (p[x] >> 10) & 0x1f, g = (p[x] >> 5) & 0x1f, b = p[x] & 0x1f;
+
+            dst[0] = (r << 3) | (r >> 2);
+            dst[1] = (g << 3) | (g >> 2);
+            dst[2] = (b << 3) | (b >> 2);
+        }
+        break;
+    }
+    }
+}
+
+void pixels_rgba_to_rgb24(uint8_t *dst, const uint8_t *src, unsigned width) {
+    unsigned x;
+
+    for (x = 0; x < width; ++x, dst += 3, src += 4) {
+        dst[0] = src[0];
+        dst[1] = src[1];
+        dst[2] = src[2];
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include "libretro.h"
+
+// Bytes per pixel of a core pixel format.
+unsigned pixels_bpp(enum retro_pixel_format format);
+
+// Converts one row of width core pixels to packed 8-bit R, G, B.
+void pixels_to_rgb24(uint8_t *dst, const void *src, unsigned width, enum retro_pixel_format format);
+
+// Converts one row of width R, G, B, A bytes, as read back from GL.
+void pixels_rgba_to_rgb24(uint8_t *dst, const uint8_t *src, unsigned width);
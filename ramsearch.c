@@ -0,0 +1,144 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ramsearch.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RAMSEARCH_SSE2
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RAMSEARCH_NEON
+#endif
+
+static struct {
+    const uint8_t *ram;
+    size_t size;
+    uint8_t *prev;  // snapshot of the last filter
+    uint8_t *alive; // 0xff for candidates, 0 otherwise
+} g_search;
+
+bool ramsearch_parse_filter(const char *name, enum ramsearch_filter *filter) {
+    if (!strcmp(name, "eq"))
+        *filter = RAMSEARCH_EQ;
+    else if (!strcmp(name, "gt"))
+        *filter = RAMSEARCH_GT;
+    else if (!strcmp(name, "changed"))
+        *filter = RAMSEARCH_CHANGED;
+    else if (!strcmp(name, "unchanged"))
+        *filter = RAMSEARCH_UNCHANGED;
+    else
+        return false;
+    return true;
+}
+
+bool ramsearch_begin(const uint8_t *ram, size_t size) {
+    ramsearch_end();
+
+    if (!ram || !size)
+        return false;
+
+    g_search.prev = malloc(size);
+    g_search.alive = malloc(size);
+    if (!g_search.prev || !g_search.alive) {
+        ramsearch_end();
+        return false;
+    }
+
+    g_search.ram = ram;
+    g_search.size = size;
+    memcpy(g_search.prev, ram, size);
+    memset(g_search.alive, 0xff, size);
+    return true;
+}
+
+static bool keep(enum ramsearch_filter filter, uint8_t cur, uint8_t prev, uint8_t value) {
+    switch (filter) {
+    case RAMSEARCH_EQ: return cur == value;
+    case RAMSEARCH_GT: return cur > value;
+    case RAMSEARCH_CHANGED: return cur != prev;
+    default: return cur == prev;
+    }
+}
+
+size_t ramsearch_filter(enum ramsearch_filter filter, uint8_t value) {
+    const uint8_t *ram = g_search.ram;
+    uint8_t *prev = g_search.prev, *alive = g_search.alive;
+    size_t i = 0, n = g_search.size, count = 0;
+#if defined(RAMSEARCH_SSE2)
+    // Unsigned compares are signed ones with the top bits flipped.
+    const __m128i bias = _mm_set1_epi8(-128), v = _mm_set1_epi8((char)value);
+    const __m128i vb = _mm_xor_si128(v, bias), ones = _mm_set1_epi8(1);
+    __m128i sum = _mm_setzero_si128();
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i cur = _mm_loadu_si128((const __m128i*)(ram + i));
+        __m128i old = _mm_loadu_si128((const __m128i*)(prev + i));
+        __m128i a = _mm_loadu_si128((const __m128i*)(alive + i)), m;
+
+        switch (filter) {
+        case RAMSEARCH_EQ: m = _mm_cmpeq_epi8(cur, v); break;
+        case RAMSEARCH_GT: m = _mm_cmpgt_epi8(_mm_xor_si128(cur, bias), vb); break;
+        case RAMSEARCH_CHANGED: m = _mm_andnot_si128(_mm_cmpeq_epi8(cur, old), _mm_set1_epi8(-1)); break;
+        default: m = _mm_cmpeq_epi8(cur, old); break;
+        }
+
+        a = _mm_and_si128(a, m);
+        _mm_storeu_si128((__m128i*)(alive + i), a);
+        _mm_storeu_si128((__m128i*)(prev + i), cur);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(_mm_and_si128(a, ones), _mm_setzero_si128()));
+    }
+
+    count = (size_t)_mm_cvtsi128_si32(sum) + (size_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+#elif defined(RAMSEARCH_NEON)
+    const uint8x16_t v = vdupq_n_u8(value), ones = vdupq_n_u8(1);
+    uint64x2_t sum = vdupq_n_u64(0);
+
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t cur = vld1q_u8(ram + i), old = vld1q_u8(prev + i), a = vld1q_u8(alive + i), m;
+
+        switch (filter) {
+        case RAMSEARCH_EQ: m = vceqq_u8(cur, v); break;
+        case RAMSEARCH_GT: m = vcgtq_u8(cur, v); break;
+        case RAMSEARCH_CHANGED: m = vmvnq_u8(vceqq_u8(cur, old)); break;
+        default: m = vceqq_u8(cur, old); break;
+        }
+
+        a = vandq_u8(a, m);
+        vst1q_u8(alive + i, a);
+        vst1q_u8(prev + i, cur);
+        sum = vaddq_u64(sum, vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(vandq_u8(a, ones)))));
+    }
+
+    count = (size_t)(vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+#endif
+
+    for (; i < n; ++i) {
+        if (alive[i] && !keep(filter, ram[i], prev[i], value))
+            alive[i] = 0;
+        prev[i] = ram[i];
+        count += alive[i] & 1;
+    }
+
+    return count;
+}
+
+size_t ramsearch_results(size_t *offsets, uint8_t *values, size_t max) {
+    size_t i, n = 0;
+
+    for (i = 0; i < g_search.size && n < max; ++i) {
+        if (!g_search.alive[i])
+            continue;
+        offsets[n] = i;
+        values[n] = g_search.ram[i];
+        n++;
+    }
+
+    return n;
+}
+
+void ramsearch_end(void) {
+    free(g_search.prev);
+    free(g_search.alive);
+
+    memset(&g_search, 0, sizeof(g_search));
+}
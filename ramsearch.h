@@ -0,0 +1,30 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Narrows down which bytes of a RAM block hold a value, as cheat finders
+// do. Each filter keeps the candidates that pass it and takes a new
+// snapshot for the next one. Scans run 16 bytes at a time with SSE2 or NEON.
+
+enum ramsearch_filter {
+    RAMSEARCH_EQ,        // equal to the value
+    RAMSEARCH_GT,        // greater than the value
+    RAMSEARCH_CHANGED,   // different from the last snapshot
+    RAMSEARCH_UNCHANGED, // same as the last snapshot
+};
+
+bool ramsearch_parse_filter(const char *name, enum ramsearch_filter *filter);
+
+// Makes every byte a candidate and snapshots the RAM, which has to stay at
+// the same place until ramsearch_end.
+bool ramsearch_begin(const uint8_t *ram, size_t size);
+
+// Returns the number of candidates left.
+size_t ramsearch_filter(enum ramsearch_filter filter, uint8_t value);
+
+// Fills in up to max candidate offsets and their current values, returns
+// how many were written.
+size_t ramsearch_results(size_t *offsets, uint8_t *values, size_t max);
+
+void ramsearch_end(void);
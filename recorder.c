@@ -0,0 +1,502 @@
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pixels.h"
+#include "recorder.h"
+#include "resampler.h"
+
+// Frames that can wait for the writer before new ones are dropped.
+#define RECORDER_SLOTS 16
+// Seconds of audio that can wait for the writer.
+#define RECORDER_AUDIO_SECONDS 2
+// Input frames resampled at a time after a sample rate change.
+#define RECORDER_RESAMPLE_CHUNK 1024
+
+struct slot {
+    unsigned width, height;
+    unsigned repeats; // repeats of the previous frame to write first
+    uint8_t *data;    // rows of width pixels, no padding
+};
+
+static struct {
+    bool active;
+    struct recorder_config config;
+    unsigned bpp;
+    FILE *video_fp, *audio_fp;
+    char video_path[1024], audio_path[1024];
+
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *cond;  // producer to writer
+    SDL_cond *space; // writer to a waiting producer
+    bool quit;
+
+    // Ready frames are slots[read .. read + ready), the producer fills
+    // slots[read + ready] outside the lock.
+    struct slot slots[RECORDER_SLOTS];
+    unsigned read, ready;
+    unsigned repeats; // producer side, attached to the next queued frame
+
+    // Ring of interleaved stereo frames, same scheme as the slots.
+    int16_t *audio;
+    size_t audio_capacity, audio_read, audio_ready;
+    size_t silence; // producer side, dropped frames still to be inserted
+
+    // Producer side, converts audio to the capture rate once the core
+    // changed its sample rate.
+    struct resampler *resampler;
+    int16_t *resampled;
+    bool audio_off;
+
+    // Writer side.
+    unsigned width, height;
+    uint8_t *rgb, *out;
+    size_t out_size;
+    bool have_frame, failed;
+
+    // Totals, written by the producer and read after the writer quit.
+    uint64_t frames, dropped;
+    uint64_t audio_frames, audio_dropped;
+} g_rec;
+
+bool recorder_parse_format(const char *name, enum recorder_format *format) {
+    if (!strcmp(name, "y4m"))
+        *format = RECORDER_Y4M;
+    else if (!strcmp(name, "rgb"))
+        *format = RECORDER_RGB;
+    else
+        return false;
+
+    return true;
+}
+
+bool recorder_active(void) {
+    return g_rec.active;
+}
+
+static void write_bytes(FILE *fp, const void *data, size_t size) {
+    if (!g_rec.failed && fwrite(data, 1, size, fp) != size) {
+        fprintf(stderr, "recorder: write failed, the rest of the capture is discarded\n");
+        g_rec.failed = true;
+    }
+}
+
+static void put_le(uint8_t *p, uint32_t v, unsigned bytes) {
+    unsigned i;
+
+    for (i = 0; i < bytes; ++i)
+        p[i] = v >> (i * 8);
+}
+
+// 44 byte PCM header, the sizes are patched in when the capture ends.
+static void write_wav_header(uint32_t data_size) {
+    uint8_t h[44];
+    uint32_t rate = (uint32_t)(g_rec.config.sample_rate + 0.5);
+
+    memcpy(h, "RIFF", 4);
+    put_le(h + 4, 36 + data_size, 4);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le(h + 16, 16, 4);
+    put_le(h + 20, 1, 2);        // PCM
+    put_le(h + 22, 2, 2);        // channels
+    put_le(h + 24, rate, 4);
+    put_le(h + 28, rate * 4, 4); // byte rate
+    put_le(h + 32, 4, 2);        // block align
+    put_le(h + 34, 16, 2);       // bits per sample
+    memcpy(h + 36, "data", 4);
+    put_le(h + 40, data_size, 4);
+
+    write_bytes(g_rec.audio_fp, h, sizeof(h));
+}
+
+// The first frame fixes the size of the stream.
+static bool start_video(unsigned width, unsigned height) {
+    g_rec.width = width;
+    g_rec.height = height;
+    g_rec.out_size = (size_t)width * height * 3;
+    g_rec.rgb = malloc((size_t)width * 3);
+    g_rec.out = calloc(1, g_rec.out_size);
+    if (!g_rec.rgb || !g_rec.out)
+        return false;
+
+    if (g_rec.config.format == RECORDER_Y4M) {
+        double par = g_rec.config.aspect_ratio > 0 ? g_rec.config.aspect_ratio * height / width : 1;
+
+        fprintf(g_rec.video_fp, "YUV4MPEG2 W%u H%u F%u:1000 Ip A%u:1000 C444\n", width, height,
+            (unsigned)(g_rec.config.fps * 1000 + 0.5), (unsigned)(par * 1000 + 0.5));
+    }
+
+    // Black until the first frame is converted.
+    if (g_rec.config.format == RECORDER_Y4M) {
+        memset(g_rec.out, 16, (size_t)width * height);
+        memset(g_rec.out + (size_t)width * height, 128, (size_t)width * height * 2);
+    }
+
+    return true;
+}
+
+// Converts a queued frame into the output buffer, cropped or padded to the
+// stream size.
+static void convert_frame(const struct slot *s) {
+    size_t plane = (size_t)g_rec.width * g_rec.height;
+    unsigned w = s->width < g_rec.width ? s->width : g_rec.width;
+    unsigned h = s->height < g_rec.height ? s->height : g_rec.height;
+    unsigned x, y;
+
+    if (w < g_rec.width || h < g_rec.height) {
+        memset(g_rec.out, g_rec.config.format == RECORDER_Y4M ? 16 : 0, plane);
+        memset(g_rec.out + plane, g_rec.config.format == RECORDER_Y4M ? 128 : 0, plane * 2);
+    }
+
+    for (y = 0; y < h; ++y) {
+        const uint8_t *src = s->data + (size_t)y * s->width * g_rec.bpp;
+
+        if (g_rec.config.format == RECORDER_RGB) {
+            pixels_to_rgb24(g_rec.out + (size_t)y * g_rec.width * 3, src, w, g_rec.config.pixel_format);
+            continue;
+        }
+
+        pixels_to_rgb24(g_rec.rgb, src, w, g_rec.config.pixel_format);
+        for (x = 0; x < w; ++x) {
+            int r = g_rec.rgb[x * 3], g = g_rec.rgb[x * 3 + 1], b = g_rec.rgb[x * 3 + 2];
+            size_t i = (size_t)y * g_rec.width + x;
+
+            g_rec.out[i]             = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+            g_rec.out[plane + i]     = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+            g_rec.out[plane * 2 + i] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+        }
+    }
+}
+
+static void write_frame(void) {
+    if (g_rec.config.format == RECORDER_Y4M)
+        write_bytes(g_rec.video_fp, "FRAME\n", 6);
+    write_bytes(g_rec.video_fp, g_rec.out, g_rec.out_size);
+}
+
+static void write_repeats(unsigned repeats) {
+    // Nothing to repeat before the first frame.
+    if (!g_rec.have_frame)
+        return;
+
+    while (repeats--)
+        write_frame();
+}
+
+static void write_slot(const struct slot *s) {
+    write_repeats(s->repeats);
+
+    if (!g_rec.have_frame) {
+        if (!start_video(s->width, s->height)) {
+            fprintf(stderr, "recorder: out of memory\n");
+            g_rec.failed = true;
+            return;
+        }
+        g_rec.have_frame = true;
+    }
+
+    convert_frame(s);
+    write_frame();
+}
+
+static void write_silence(size_t frames) {
+    static const int16_t zero[512 * 2];
+
+    while (frames) {
+        size_t n = frames < 512 ? frames : 512;
+
+        write_bytes(g_rec.audio_fp, zero, n * 4);
+        frames -= n;
+    }
+}
+
+static int writer_thread(void *data) {
+    (void)data;
+
+    SDL_LockMutex(g_rec.lock);
+    for (;;) {
+        unsigned read = g_rec.read, ready = g_rec.ready, i;
+        size_t audio_read = g_rec.audio_read, audio_ready = g_rec.audio_ready, n;
+
+        if (!ready && !audio_ready) {
+            if (g_rec.quit)
+                break;
+            SDL_CondWait(g_rec.cond, g_rec.lock);
+            continue;
+        }
+        SDL_UnlockMutex(g_rec.lock);
+
+        for (i = 0; i < ready; ++i)
+            write_slot(&g_rec.slots[(read + i) % RECORDER_SLOTS]);
+
+        n = g_rec.audio_capacity - audio_read;
+        if (n > audio_ready)
+            n = audio_ready;
+        write_bytes(g_rec.audio_fp, g_rec.audio + audio_read * 2, n * 4);
+        write_bytes(g_rec.audio_fp, g_rec.audio, (audio_ready - n) * 4);
+
+        SDL_LockMutex(g_rec.lock);
+        g_rec.read = (read + ready) % RECORDER_SLOTS;
+        g_rec.ready -= ready;
+        g_rec.audio_read = (audio_read + audio_ready) % g_rec.audio_capacity;
+        g_rec.audio_ready -= audio_ready;
+        SDL_CondSignal(g_rec.space);
+    }
+    SDL_UnlockMutex(g_rec.lock);
+
+    // Whatever was dropped after the last queued frame and samples.
+    write_repeats(g_rec.repeats);
+    write_silence(g_rec.silence);
+
+    return 0;
+}
+
+static FILE *open_output(char *path, size_t size, const char *base, const char *ext) {
+    FILE *fp;
+
+    snprintf(path, size, "%s.%s", base, ext);
+    if (!(fp = fopen(path, "wb")))
+        fprintf(stderr, "recorder: failed to open %s\n", path);
+
+    return fp;
+}
+
+bool recorder_open(const char *base, const struct recorder_config *config) {
+    size_t slot_size;
+    unsigned i;
+
+    memset(&g_rec, 0, sizeof(g_rec));
+    g_rec.config = *config;
+    g_rec.bpp = pixels_bpp(config->pixel_format);
+
+    g_rec.video_fp = open_output(g_rec.video_path, sizeof(g_rec.video_path), base,
+        config->format == RECORDER_Y4M ? "y4m" : "rgb");
+    g_rec.audio_fp = open_output(g_rec.audio_path, sizeof(g_rec.audio_path), base, "wav");
+    if (!g_rec.video_fp || !g_rec.audio_fp)
+        return false;
+
+    // Everything the producer touches is allocated up front.
+    slot_size = (size_t)config->max_width * config->max_height * g_rec.bpp;
+    for (i = 0; i < RECORDER_SLOTS; ++i)
+        if (!(g_rec.slots[i].data = malloc(slot_size)))
+            return false;
+
+    g_rec.audio_capacity = (size_t)(config->sample_rate * RECORDER_AUDIO_SECONDS);
+    if (!g_rec.audio_capacity || !(g_rec.audio = malloc(g_rec.audio_capacity * 4)))
+        return false;
+
+    write_wav_header(0);
+
+    g_rec.lock = SDL_CreateMutex();
+    g_rec.cond = SDL_CreateCond();
+    g_rec.space = SDL_CreateCond();
+    if (!g_rec.lock || !g_rec.cond || !g_rec.space)
+        return false;
+
+    g_rec.thread = SDL_CreateThread(writer_thread, "recorder", NULL);
+    if (!g_rec.thread)
+        return false;
+
+    g_rec.active = true;
+    return true;
+}
+
+void recorder_video(const void *data, unsigned width, unsigned height, size_t pitch) {
+    struct slot *s;
+    unsigned ready, y;
+
+    if (!g_rec.active)
+        return;
+
+    g_rec.frames++;
+
+    if (!data || data == RETRO_HW_FRAME_BUFFER_VALID || width > g_rec.config.max_width ||
+        height > g_rec.config.max_height) {
+        // HW rendered frames are not read back, keep the timing with repeats.
+        if (data)
+            g_rec.dropped++;
+        g_rec.repeats++;
+        return;
+    }
+
+    SDL_LockMutex(g_rec.lock);
+    while (g_rec.config.wait && g_rec.ready == RECORDER_SLOTS)
+        SDL_CondWait(g_rec.space, g_rec.lock);
+    ready = g_rec.ready;
+    s = &g_rec.slots[(g_rec.read + ready) % RECORDER_SLOTS];
+    SDL_UnlockMutex(g_rec.lock);
+
+    if (ready == RECORDER_SLOTS) {
+        g_rec.dropped++;
+        g_rec.repeats++;
+        return;
+    }
+
+    s->width = width;
+    s->height = height;
+    s->repeats = g_rec.repeats;
+    g_rec.repeats = 0;
+    for (y = 0; y < height; ++y)
+        memcpy(s->data + (size_t)y * width * g_rec.bpp, (const uint8_t*)data + y * pitch, width * g_rec.bpp);
+
+    SDL_LockMutex(g_rec.lock);
+    g_rec.ready++;
+    SDL_CondSignal(g_rec.cond);
+    SDL_UnlockMutex(g_rec.lock);
+}
+
+// Copies frames into the ring at its current end, returns how many fit.
+static size_t audio_put(const int16_t *data, size_t frames) {
+    size_t pos, space, n, i;
+
+    SDL_LockMutex(g_rec.lock);
+    while (g_rec.config.wait && g_rec.audio_ready == g_rec.audio_capacity)
+        SDL_CondWait(g_rec.space, g_rec.lock);
+    pos = (g_rec.audio_read + g_rec.audio_ready) % g_rec.audio_capacity;
+    space = g_rec.audio_capacity - g_rec.audio_ready;
+    SDL_UnlockMutex(g_rec.lock);
+
+    if (frames > space)
+        frames = space;
+
+    for (i = 0; i < frames; i += n) {
+        n = g_rec.audio_capacity - pos;
+        if (n > frames - i)
+            n = frames - i;
+
+        if (data)
+            memcpy(g_rec.audio + pos * 2, data + i * 2, n * 4);
+        else
+            memset(g_rec.audio + pos * 2, 0, n * 4);
+        pos = (pos + n) % g_rec.audio_capacity;
+    }
+
+    SDL_LockMutex(g_rec.lock);
+    g_rec.audio_ready += frames;
+    SDL_CondSignal(g_rec.cond);
+    SDL_UnlockMutex(g_rec.lock);
+
+    return frames;
+}
+
+static void queue_audio(const int16_t *data, size_t frames) {
+    size_t n;
+
+    g_rec.audio_frames += frames;
+
+    // Silence for earlier drops goes first so the samples stay in place.
+    if (g_rec.silence) {
+        g_rec.silence -= audio_put(NULL, g_rec.silence);
+        if (g_rec.silence) {
+            g_rec.silence += frames;
+            g_rec.audio_dropped += frames;
+            return;
+        }
+    }
+
+    n = audio_put(data, frames);
+    while (g_rec.config.wait && n < frames)
+        n += audio_put(data + n * 2, frames - n);
+    g_rec.silence += frames - n;
+    g_rec.audio_dropped += frames - n;
+}
+
+void recorder_audio(const int16_t *data, size_t frames) {
+    size_t i, n;
+
+    if (!g_rec.active || !frames || g_rec.audio_off)
+        return;
+
+    if (!g_rec.resampler) {
+        queue_audio(data, frames);
+        return;
+    }
+
+    for (i = 0; i < frames; i += n) {
+        n = frames - i < RECORDER_RESAMPLE_CHUNK ? frames - i : RECORDER_RESAMPLE_CHUNK;
+        queue_audio(g_rec.resampled, resampler_process(g_rec.resampler, data + i * 2, n, g_rec.resampled));
+    }
+}
+
+// Writes out what the resampler still holds, so no audio is lost between
+// two rates.
+static void finish_resampler(void) {
+    if (!g_rec.resampler)
+        return;
+
+    queue_audio(g_rec.resampled, resampler_flush(g_rec.resampler, g_rec.resampled));
+    resampler_free(g_rec.resampler);
+    g_rec.resampler = NULL;
+}
+
+void recorder_set_sample_rate(double rate) {
+    int16_t *resampled;
+
+    if (!g_rec.active || g_rec.audio_off)
+        return;
+
+    finish_resampler();
+    if (rate == g_rec.config.sample_rate)
+        return;
+
+    g_rec.resampler = resampler_new(rate, g_rec.config.sample_rate, g_rec.config.quality);
+    resampled = g_rec.resampler ? realloc(g_rec.resampled,
+        resampler_max_output(g_rec.resampler, RECORDER_RESAMPLE_CHUNK) * 4) : NULL;
+    if (!resampled) {
+        fprintf(stderr, "recorder: failed to resample %.0f Hz audio, the rest of the audio is not captured\n", rate);
+        resampler_free(g_rec.resampler);
+        g_rec.resampler = NULL;
+        g_rec.audio_off = true;
+        return;
+    }
+
+    g_rec.resampled = resampled;
+}
+
+void recorder_close(void) {
+    long size;
+    unsigned i;
+
+    if (g_rec.active)
+        finish_resampler();
+
+    if (g_rec.thread) {
+        SDL_LockMutex(g_rec.lock);
+        g_rec.quit = true;
+        SDL_CondSignal(g_rec.cond);
+        SDL_UnlockMutex(g_rec.lock);
+        SDL_WaitThread(g_rec.thread, NULL);
+    }
+
+    if (g_rec.audio_fp) {
+        size = ftell(g_rec.audio_fp);
+        if (size >= 44 && !fseek(g_rec.audio_fp, 0, SEEK_SET))
+            write_wav_header((uint32_t)(size - 44));
+        fclose(g_rec.audio_fp);
+    }
+
+    if (g_rec.video_fp)
+        fclose(g_rec.video_fp);
+
+    if (g_rec.active)
+        printf("Recorded %llu frames to %s (%llu dropped) and %.1f s of audio to %s (%llu frames dropped)%s\r\n",
+            (unsigned long long)g_rec.frames, g_rec.video_path, (unsigned long long)g_rec.dropped,
+            g_rec.audio_frames / g_rec.config.sample_rate, g_rec.audio_path,
+            (unsigned long long)g_rec.audio_dropped, g_rec.failed ? ", write errors" : "");
+
+    for (i = 0; i < RECORDER_SLOTS; ++i)
+        free(g_rec.slots[i].data);
+    free(g_rec.audio);
+    free(g_rec.resampled);
+    free(g_rec.rgb);
+    free(g_rec.out);
+    if (g_rec.cond)
+        SDL_DestroyCond(g_rec.cond);
+    if (g_rec.space)
+        SDL_DestroyCond(g_rec.space);
+    if (g_rec.lock)
+        SDL_DestroyMutex(g_rec.lock);
+
+    memset(&g_rec, 0, sizeof(g_rec));
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "libretro.h"
+#include "resampler.h"
+
+// Captures the core's output to <base>.y4m or <base>.rgb plus <base>.wav.
+// Frames and samples are copied into preallocated buffers and written by a
+// background thread; when the disk falls behind, frames are dropped and
+// replaced by repeats so the timing stays correct. Runs without a real-time
+// deadline can wait for the writer instead.
+enum recorder_format {
+    RECORDER_Y4M, // YUV 4:4:4, BT.601 limited range
+    RECORDER_RGB, // headerless packed 8-bit RGB
+};
+
+struct recorder_config {
+    enum recorder_format format;
+    enum retro_pixel_format pixel_format;
+    unsigned max_width, max_height;
+    float aspect_ratio;
+    double fps;
+    double sample_rate; // of the WAV file, for the whole capture
+    enum resampler_quality quality;
+    bool wait; // block when the buffers are full rather than drop
+};
+
+// Accepts "y4m" or "rgb".
+bool recorder_parse_format(const char *name, enum recorder_format *format);
+
+bool recorder_open(const char *base, const struct recorder_config *config);
+bool recorder_active(void);
+
+// A NULL frame repeats the previous one. The first frame fixes the output
+// size, smaller or larger frames are cropped or padded with black.
+void recorder_video(const void *data, unsigned width, unsigned height, size_t pitch);
+
+// Interleaved stereo at the core's sample rate.
+void recorder_audio(const int16_t *data, size_t frames);
+
+// The core switched to another sample rate, later audio is resampled to the
+// rate the capture was opened with so it stays in sync with the video.
+void recorder_set_sample_rate(double rate);
+
+// Writes out everything still queued, finishes the files and prints what was
+// captured and dropped.
+void recorder_close(void);
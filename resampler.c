@@ -0,0 +1,303 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resampler.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RESAMPLER_SSE
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define RESAMPLER_NEON
+#endif
+
+// Sinc filters are tabulated at this many fractional positions, outputs
+// interpolate between the two nearest ones.
+#define SINC_PHASES 256
+#define KAISER_BETA 8.0
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+struct resampler {
+    enum resampler_quality quality;
+    unsigned taps;
+
+    // SINC_PHASES + 1 filters of taps coefficients, each stored twice so
+    // they line up with interleaved stereo frames.
+    float *table;
+
+    double step; // input frames per output frame
+    double pos;  // position of the next output frame in buf
+
+    // Interleaved stereo input, starting with the oldest frame still under
+    // the filter.
+    float *buf;
+    size_t frames;
+    size_t capacity;
+};
+
+static const char *quality_names[] = {
+    [RESAMPLER_CUBIC]   = "cubic",
+    [RESAMPLER_SINC]    = "sinc",
+    [RESAMPLER_SINC_HQ] = "sinc-hq",
+};
+
+bool resampler_parse_quality(const char *name, enum resampler_quality *quality) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(quality_names) / sizeof(quality_names[0]); ++i) {
+        if (!strcmp(name, quality_names[i])) {
+            *quality = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *resampler_quality_name(enum resampler_quality quality) {
+    return quality_names[quality];
+}
+
+// Zeroth order modified Bessel function of the first kind.
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    unsigned k;
+
+    for (k = 1; k < 32; ++k) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+
+    return sum;
+}
+
+static bool build_sinc_table(struct resampler *r, double cutoff) {
+    unsigned half = r->taps / 2, phase, j;
+    double norm = bessel_i0(KAISER_BETA);
+
+    r->table = malloc(sizeof(float) * (SINC_PHASES + 1) * r->taps * 2);
+    if (!r->table)
+        return false;
+
+    for (phase = 0; phase <= SINC_PHASES; ++phase) {
+        float *c = r->table + phase * r->taps * 2;
+        double frac = (double)phase / SINC_PHASES;
+        double sum = 0;
+
+        for (j = 0; j < r->taps; ++j) {
+            double d = (double)j + 1 - half - frac;
+            double x = d / half;
+            double w = fabs(x) < 1 ? bessel_i0(KAISER_BETA * sqrt(1 - x * x)) / norm : 0;
+            double s = fabs(d) < 1e-9 ? 1 : sin(M_PI * cutoff * d) / (M_PI * cutoff * d);
+
+            c[j * 2] = cutoff * s * w;
+            sum += c[j * 2];
+        }
+
+        // Unity gain at DC for every phase.
+        for (j = 0; j < r->taps; ++j)
+            c[j * 2] = c[j * 2 + 1] = c[j * 2] / sum;
+    }
+
+    return true;
+}
+
+struct resampler *resampler_new(double in_rate, double out_rate, enum resampler_quality quality) {
+    struct resampler *r;
+
+    if (in_rate <= 0 || out_rate <= 0)
+        return NULL;
+
+    r = calloc(1, sizeof(*r));
+    if (!r)
+        return NULL;
+
+    r->quality = quality;
+    r->step = in_rate / out_rate;
+
+    switch (quality) {
+    case RESAMPLER_SINC_HQ: r->taps = 32; break;
+    case RESAMPLER_SINC:    r->taps = 16; break;
+    default:                r->taps = 4;  break;
+    }
+
+    // Downsampling moves the cutoff below the output Nyquist rate, a bit of
+    // headroom keeps the transition band out of the audible range.
+    if (quality != RESAMPLER_CUBIC && !build_sinc_table(r, 0.97 * (r->step > 1 ? 1 / r->step : 1))) {
+        resampler_free(r);
+        return NULL;
+    }
+
+    // Start with silence under the past half of the filter.
+    r->capacity = 4096;
+    r->buf = calloc(r->capacity * 2, sizeof(float));
+    if (!r->buf) {
+        resampler_free(r);
+        return NULL;
+    }
+    r->frames = r->taps / 2 - 1;
+    r->pos = r->frames;
+
+    return r;
+}
+
+void resampler_free(struct resampler *r) {
+    if (!r)
+        return;
+
+    free(r->table);
+    free(r->buf);
+    free(r);
+}
+
+size_t resampler_max_output(const struct resampler *r, size_t in_frames) {
+    return (size_t)((in_frames + 1) / r->step) + 2;
+}
+
+// Stereo dot product of n interleaved floats, n a multiple of 8.
+static inline void dot2(const float *x, const float *c, unsigned n, float *out) {
+    unsigned i;
+#if defined(RESAMPLER_SSE)
+    __m128 a = _mm_setzero_ps(), b = _mm_setzero_ps();
+
+    for (i = 0; i < n; i += 8) {
+        a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(c + i)));
+        b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(c + i + 4)));
+    }
+
+    // Lanes hold L R L R partial sums.
+    a = _mm_add_ps(a, b);
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    _mm_storel_pi((__m64*)out, a);
+#elif defined(RESAMPLER_NEON)
+    float32x4_t a = vdupq_n_f32(0), b = vdupq_n_f32(0);
+    float32x2_t s;
+
+    for (i = 0; i < n; i += 8) {
+        a = vmlaq_f32(a, vld1q_f32(x + i), vld1q_f32(c + i));
+        b = vmlaq_f32(b, vld1q_f32(x + i + 4), vld1q_f32(c + i + 4));
+    }
+
+    a = vaddq_f32(a, b);
+    s = vadd_f32(vget_low_f32(a), vget_high_f32(a));
+    vst1_f32(out, s);
+#else
+    float l = 0, r = 0;
+
+    for (i = 0; i < n; i += 2) {
+        l += x[i] * c[i];
+        r += x[i + 1] * c[i + 1];
+    }
+
+    out[0] = l;
+    out[1] = r;
+#endif
+}
+
+// Catmull-Rom interpolation of 4 interleaved stereo frames, the weights
+// are splatted in registers rather than loaded from a table.
+static inline void cubic2(const float *x, float frac, float *out) {
+    float t2 = frac * frac, t3 = t2 * frac;
+    float w0 = 0.5f * (-t3 + 2 * t2 - frac);
+    float w1 = 0.5f * (3 * t3 - 5 * t2 + 2);
+    float w2 = 0.5f * (-3 * t3 + 4 * t2 + frac);
+    float w3 = 0.5f * (t3 - t2);
+#if defined(RESAMPLER_SSE)
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(x), _mm_set_ps(w1, w1, w0, w0));
+
+    a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + 4), _mm_set_ps(w3, w3, w2, w2)));
+    a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+    _mm_storel_pi((__m64*)out, a);
+#elif defined(RESAMPLER_NEON)
+    float32x4_t a = vmulq_f32(vld1q_f32(x), vcombine_f32(vdup_n_f32(w0), vdup_n_f32(w1)));
+
+    a = vmlaq_f32(a, vld1q_f32(x + 4), vcombine_f32(vdup_n_f32(w2), vdup_n_f32(w3)));
+    vst1_f32(out, vadd_f32(vget_low_f32(a), vget_high_f32(a)));
+#else
+    out[0] = x[0] * w0 + x[2] * w1 + x[4] * w2 + x[6] * w3;
+    out[1] = x[1] * w0 + x[3] * w1 + x[5] * w2 + x[7] * w3;
+#endif
+}
+
+static int16_t to_s16(float s) {
+    s *= 32768.0f;
+    if (s >= 32767.0f)
+        return 32767;
+    if (s <= -32768.0f)
+        return -32768;
+    // Rounds to nearest without a libm call.
+    return (int16_t)(s < 0 ? s - 0.5f : s + 0.5f);
+}
+
+size_t resampler_process(struct resampler *r, const int16_t *in, size_t in_frames, int16_t *out) {
+    unsigned half = r->taps / 2, n = r->taps * 2;
+    size_t produced = 0, drop, i;
+    double pos, end;
+    float *dst;
+
+    if (r->frames + in_frames > r->capacity) {
+        size_t capacity = (r->frames + in_frames) * 2;
+        float *buf = realloc(r->buf, capacity * 2 * sizeof(float));
+
+        if (!buf)
+            return 0;
+
+        r->buf = buf;
+        r->capacity = capacity;
+    }
+
+    dst = r->buf + r->frames * 2;
+    for (i = 0; i < in_frames * 2; ++i)
+        dst[i] = in[i] * (1.0f / 32768.0f);
+    r->frames += in_frames;
+
+    // Each output needs half frames past its position.
+    pos = r->pos;
+    end = (double)(r->frames - half);
+    while (pos < end) {
+        size_t base = (size_t)(long)pos;
+        float frac = (float)(pos - (long)pos);
+        const float *x = r->buf + (base + 1 - half) * 2;
+        float s[2];
+
+        if (r->quality == RESAMPLER_CUBIC) {
+            cubic2(x, frac, s);
+        } else {
+            float ph = frac * SINC_PHASES;
+            unsigned k = (unsigned)ph;
+            const float *c = r->table + k * n;
+            float a[2], b[2];
+
+            ph -= k;
+            dot2(x, c, n, a);
+            dot2(x, c + n, n, b);
+            s[0] = a[0] + ph * (b[0] - a[0]);
+            s[1] = a[1] + ph * (b[1] - a[1]);
+        }
+
+        out[produced * 2 + 0] = to_s16(s[0]);
+        out[produced * 2 + 1] = to_s16(s[1]);
+        produced++;
+        pos += r->step;
+    }
+    r->pos = pos;
+
+    // Drop the frames no future output reaches.
+    drop = (size_t)r->pos + 1 - half;
+    if (drop > r->frames)
+        drop = r->frames;
+    memmove(r->buf, r->buf + drop * 2, (r->frames - drop) * 2 * sizeof(float));
+    r->frames -= drop;
+    r->pos -= drop;
+
+    return produced;
+}
+
+size_t resampler_flush(struct resampler *r, int16_t *out) {
+    static const int16_t silence[32 * 2];
+
+    return resampler_process(r, silence, r->taps / 2, out);
+}
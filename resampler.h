@@ -0,0 +1,33 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Converts interleaved stereo int16 audio between sample rates.
+enum resampler_quality {
+    RESAMPLER_CUBIC,   // 4 point Catmull-Rom, cheapest
+    RESAMPLER_SINC,    // 16 tap windowed sinc
+    RESAMPLER_SINC_HQ, // 32 tap windowed sinc
+};
+
+struct resampler;
+
+// Accepts "cubic", "sinc" or "sinc-hq".
+bool resampler_parse_quality(const char *name, enum resampler_quality *quality);
+const char *resampler_quality_name(enum resampler_quality quality);
+
+struct resampler *resampler_new(double in_rate, double out_rate, enum resampler_quality quality);
+void resampler_free(struct resampler *r);
+
+// Upper bound of the output frames produced for in_frames input frames.
+size_t resampler_max_output(const struct resampler *r, size_t in_frames);
+
+// Consumes all input frames and returns the number of frames written to
+// out, at most resampler_max_output(in_frames). The filter delay is kept
+// across calls, so a stream can be fed in chunks of any size.
+size_t resampler_process(struct resampler *r, const int16_t *in, size_t in_frames, int16_t *out);
+
+// Pushes the frames still waiting for later input out with silence, before
+// the stream ends or switches to another resampler. Writes at most
+// resampler_max_output(32) frames.
+size_t resampler_flush(struct resampler *r, int16_t *out);
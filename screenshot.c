@@ -0,0 +1,324 @@
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pixels.h"
+#include "screenshot.h"
+
+// Shots that can wait for the worker before new ones are skipped.
+#define SCREENSHOT_JOBS 4
+// Largest stored deflate block.
+#define STORED_MAX 65535
+
+struct job {
+    char path[1024];
+    unsigned width, height;
+    enum retro_pixel_format format;
+    bool rgba;       // RGBA bytes, bottom row first
+    uint8_t *data;   // rows without padding
+    size_t capacity;
+};
+
+static struct {
+    bool active;
+    char dir[960];
+    bool wait;
+
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *cond;  // producer to worker
+    SDL_cond *space; // worker to a waiting producer
+    bool quit;
+
+    // Queued jobs are jobs[read .. read + ready), as in the recorder.
+    struct job jobs[SCREENSHOT_JOBS];
+    unsigned read, ready;
+
+    // Worker side.
+    uint8_t *rgb;
+    size_t rgb_size;
+    uint32_t crc_table[256];
+} g_shot;
+
+static void crc_init(void) {
+    uint32_t c, n, k;
+
+    for (n = 0; n < 256; ++n) {
+        for (c = n, k = 0; k < 8; ++k)
+            c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+        g_shot.crc_table[n] = c;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const uint8_t *p, size_t len) {
+    while (len--)
+        crc = g_shot.crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+static void put_be32(uint8_t *p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+// PNG chunks are written piecewise so the IDAT body needs no extra copy.
+struct chunk {
+    FILE *fp;
+    uint32_t crc;
+    bool ok;
+};
+
+static void chunk_begin(struct chunk *c, const char *type, uint32_t length) {
+    uint8_t h[8];
+
+    put_be32(h, length);
+    memcpy(h + 4, type, 4);
+    c->ok = c->ok && fwrite(h, 1, 8, c->fp) == 8;
+    c->crc = crc_update(0xffffffff, h + 4, 4);
+}
+
+static void chunk_data(struct chunk *c, const void *data, size_t length) {
+    c->ok = c->ok && fwrite(data, 1, length, c->fp) == length;
+    c->crc = crc_update(c->crc, data, length);
+}
+
+static void chunk_end(struct chunk *c) {
+    uint8_t t[4];
+
+    put_be32(t, c->crc ^ 0xffffffff);
+    c->ok = c->ok && fwrite(t, 1, 4, c->fp) == 4;
+}
+
+// Uncompressed zlib stream of filter type 0 rows. Encoding stays a plain
+// copy and a checksum, the files are about the size of the raw frame.
+static bool write_png(const char *path, const uint8_t *rgb, unsigned width, unsigned height) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const uint8_t zlib_header[2] = { 0x78, 0x01 };
+    size_t row = (size_t)width * 3 + 1, raw = row * height;
+    size_t blocks = (raw + STORED_MAX - 1) / STORED_MAX, left = raw, block_left = 0;
+    uint32_t adler_a = 1, adler_b = 0;
+    struct chunk c = { fopen(path, "wb"), 0, true };
+    uint8_t ihdr[13], b[5];
+    unsigned y;
+
+    if (!c.fp)
+        return false;
+
+    c.ok = fwrite(signature, 1, 8, c.fp) == 8;
+
+    put_be32(ihdr, width);
+    put_be32(ihdr + 4, height);
+    ihdr[8] = 8;  // bit depth
+    ihdr[9] = 2;  // truecolor
+    ihdr[10] = ihdr[11] = ihdr[12] = 0;
+    chunk_begin(&c, "IHDR", 13);
+    chunk_data(&c, ihdr, 13);
+    chunk_end(&c);
+
+    chunk_begin(&c, "IDAT", (uint32_t)(2 + blocks * 5 + raw + 4));
+    chunk_data(&c, zlib_header, 2);
+
+    for (y = 0; y < height; ++y) {
+        const uint8_t *src = rgb + (size_t)y * (row - 1);
+        size_t done = 0, n, i;
+        uint8_t filter = 0;
+
+        // Each row is the filter byte followed by the pixels, split across
+        // stored blocks wherever they end.
+        while (done < row) {
+            if (!block_left) {
+                block_left = left < STORED_MAX ? left : STORED_MAX;
+                left -= block_left;
+                b[0] = !left;
+                b[1] = block_left;
+                b[2] = block_left >> 8;
+                b[3] = ~block_left;
+                b[4] = ~block_left >> 8;
+                chunk_data(&c, b, 5);
+            }
+
+            n = row - done < block_left ? row - done : block_left;
+            if (!done) {
+                chunk_data(&c, &filter, 1);
+                adler_b = (adler_b + adler_a) % 65521;
+                chunk_data(&c, src, n - 1);
+            } else {
+                chunk_data(&c, src + done - 1, n);
+            }
+
+            for (i = done ? done - 1 : 0; i < done + n - 1; ++i) {
+                adler_a = (adler_a + src[i]) % 65521;
+                adler_b = (adler_b + adler_a) % 65521;
+            }
+
+            done += n;
+            block_left -= n;
+        }
+    }
+
+    put_be32(b, (adler_b << 16) | adler_a);
+    chunk_data(&c, b, 4);
+    chunk_end(&c);
+
+    chunk_begin(&c, "IEND", 0);
+    chunk_end(&c);
+
+    return !fclose(c.fp) && c.ok;
+}
+
+static void encode(const struct job *j) {
+    size_t size = (size_t)j->width * j->height * 3;
+    unsigned y;
+
+    if (size > g_shot.rgb_size) {
+        uint8_t *rgb = realloc(g_shot.rgb, size);
+
+        if (!rgb) {
+            fprintf(stderr, "screenshot: out of memory for %s\n", j->path);
+            return;
+        }
+        g_shot.rgb = rgb;
+        g_shot.rgb_size = size;
+    }
+
+    for (y = 0; y < j->height; ++y) {
+        uint8_t *dst = g_shot.rgb + (size_t)y * j->width * 3;
+
+        if (j->rgba)
+            pixels_rgba_to_rgb24(dst, j->data + (size_t)(j->height - 1 - y) * j->width * 4, j->width);
+        else
+            pixels_to_rgb24(dst, j->data + (size_t)y * j->width * pixels_bpp(j->format), j->width, j->format);
+    }
+
+    if (write_png(j->path, g_shot.rgb, j->width, j->height))
+        printf("Screenshot saved to %s\r\n", j->path);
+    else
+        fprintf(stderr, "screenshot: failed to write %s\n", j->path);
+}
+
+static int worker_thread(void *data) {
+    (void)data;
+
+    SDL_LockMutex(g_shot.lock);
+    for (;;) {
+        unsigned read = g_shot.read;
+
+        if (!g_shot.ready) {
+            if (g_shot.quit)
+                break;
+            SDL_CondWait(g_shot.cond, g_shot.lock);
+            continue;
+        }
+        SDL_UnlockMutex(g_shot.lock);
+
+        encode(&g_shot.jobs[read]);
+
+        SDL_LockMutex(g_shot.lock);
+        g_shot.read = (read + 1) % SCREENSHOT_JOBS;
+        g_shot.ready--;
+        SDL_CondSignal(g_shot.space);
+    }
+    SDL_UnlockMutex(g_shot.lock);
+
+    return 0;
+}
+
+bool screenshot_init(const char *dir, bool wait) {
+    memset(&g_shot, 0, sizeof(g_shot));
+    snprintf(g_shot.dir, sizeof(g_shot.dir), "%s", dir);
+    g_shot.wait = wait;
+    crc_init();
+
+    g_shot.lock = SDL_CreateMutex();
+    g_shot.cond = SDL_CreateCond();
+    g_shot.space = SDL_CreateCond();
+    if (!g_shot.lock || !g_shot.cond || !g_shot.space)
+        return false;
+
+    g_shot.thread = SDL_CreateThread(worker_thread, "screenshot", NULL);
+    if (!g_shot.thread)
+        return false;
+
+    g_shot.active = true;
+    return true;
+}
+
+static bool queue(const char *name, const void *data, unsigned width, unsigned height, size_t pitch,
+                  size_t bpp, enum retro_pixel_format format, bool rgba) {
+    size_t row = (size_t)width * bpp;
+    struct job *j;
+    unsigned y;
+
+    if (!g_shot.active)
+        return false;
+
+    SDL_LockMutex(g_shot.lock);
+    while (g_shot.wait && g_shot.ready == SCREENSHOT_JOBS)
+        SDL_CondWait(g_shot.space, g_shot.lock);
+    j = g_shot.ready < SCREENSHOT_JOBS ? &g_shot.jobs[(g_shot.read + g_shot.ready) % SCREENSHOT_JOBS] : NULL;
+    SDL_UnlockMutex(g_shot.lock);
+
+    if (!j) {
+        fprintf(stderr, "screenshot: still busy, skipped %s\n", name);
+        return false;
+    }
+
+    if (row * height > j->capacity) {
+        uint8_t *buf = realloc(j->data, row * height);
+
+        if (!buf)
+            return false;
+        j->data = buf;
+        j->capacity = row * height;
+    }
+
+    snprintf(j->path, sizeof(j->path), "%s/%s", g_shot.dir, name);
+    j->width = width;
+    j->height = height;
+    j->format = format;
+    j->rgba = rgba;
+    for (y = 0; y < height; ++y)
+        memcpy(j->data + y * row, (const uint8_t*)data + y * pitch, row);
+
+    SDL_LockMutex(g_shot.lock);
+    g_shot.ready++;
+    SDL_CondSignal(g_shot.cond);
+    SDL_UnlockMutex(g_shot.lock);
+
+    return true;
+}
+
+bool screenshot_write(const char *name, const void *data, unsigned width, unsigned height, size_t pitch,
+                      enum retro_pixel_format format) {
+    return queue(name, data, width, height, pitch, pixels_bpp(format), format, false);
+}
+
+bool screenshot_write_rgba(const char *name, const void *data, unsigned width, unsigned height) {
+    return queue(name, data, width, height, (size_t)width * 4, 4, RETRO_PIXEL_FORMAT_XRGB8888, true);
+}
+
+void screenshot_deinit(void) {
+    unsigned i;
+
+    if (g_shot.thread) {
+        SDL_LockMutex(g_shot.lock);
+        g_shot.quit = true;
+        SDL_CondSignal(g_shot.cond);
+        SDL_UnlockMutex(g_shot.lock);
+        SDL_WaitThread(g_shot.thread, NULL);
+    }
+
+    for (i = 0; i < SCREENSHOT_JOBS; ++i)
+        free(g_shot.jobs[i].data);
+    free(g_shot.rgb);
+    if (g_shot.cond)
+        SDL_DestroyCond(g_shot.cond);
+    if (g_shot.space)
+        SDL_DestroyCond(g_shot.space);
+    if (g_shot.lock)
+        SDL_DestroyMutex(g_shot.lock);
+
+    memset(&g_shot, 0, sizeof(g_shot));
+}
@@ -0,0 +1,21 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "libretro.h"
+
+// Saves PNG screenshots from a worker thread. Frames are copied on the
+// calling thread, pixel conversion, encoding and the file write happen on
+// the worker. With wait set, a full queue blocks rather than skips shots,
+// for runs without a real-time deadline.
+bool screenshot_init(const char *dir, bool wait);
+
+// Queues a frame of core pixels for <dir>/<name>. Returns false, skipping
+// the shot, when the worker is still busy with earlier ones.
+bool screenshot_write(const char *name, const void *data, unsigned width, unsigned height, size_t pitch,
+                      enum retro_pixel_format format);
+
+// Same for RGBA rows read back from GL, bottom row first.
+bool screenshot_write_rgba(const char *name, const void *data, unsigned width, unsigned height);
+
+// Waits for queued shots to be written.
+void screenshot_deinit(void);
@@ -1,23 +1,184 @@
 #include <SDL.h>
 #include "libretro.h"
+#include "batch.h"
+#include "cheats.h"
 #include "glad.h"
+#include "gl_debug.h"
+#include "gl_loader.h"
 #include "gles.h"
+#include "golden.h"
+#include "hash.h"
+#include "memmap.h"
+#include "movie.h"
+#include "netplay.h"
+#include "pacing.h"
+#include "ramsearch.h"
+#include "recorder.h"
+#include "resampler.h"
+#include "screenshot.h"
+#include "sram.h"
+#include "telemetry.h"
+
+// The device always runs at this rate, core audio is resampled to it.
+#define AUDIO_DEVICE_RATE 48000
+static enum resampler_quality g_resampler_quality = RESAMPLER_SINC;
+
+// Per-sample writes are staged and queued in one go after retro_run.
+#define AUDIO_STAGE_FRAMES 2048
+
+struct frontend_callbacks {
+    retro_environment_t environment;
+    retro_video_refresh_t video_refresh;
+    retro_input_poll_t input_poll;
+    retro_input_state_t input_state;
+    retro_audio_sample_t audio_sample;
+    retro_audio_sample_batch_t audio_sample_batch;
+    retro_hw_get_current_framebuffer_t get_current_framebuffer;
+};
+
+// Everything a loaded core is wired to. Libretro callbacks carry no user
+// pointer, so every context has its own trampolines passing its address as a
+// constant and the callbacks never look their context up.
+struct frontend {
+    GRetro retro;
+    GVideo video;
+    const struct frontend_callbacks *callbacks;
+    SDL_Window *win;
+    SDL_GLContext ctx;
+    // No window, GL context or audio device.
+    bool headless;
+    bool running;
+
+    enum retro_pixel_format pixel_format;
+    // Current geometry and timing, as last reported by the core.
+    struct retro_system_av_info av;
+    // Pad state by port, the second port is only driven by netplay.
+    unsigned joy[NETPLAY_PLAYERS][RETRO_DEVICE_ID_JOYPAD_R3+1];
+    struct retro_frame_time_callback frame_time;
+    retro_usec_t frame_time_last;
+
+    SDL_AudioDeviceID pcm;
+    struct retro_audio_callback audio_callback;
+    int audio_rate;
+    struct resampler *resampler;
+    int16_t *resample_buf;
+    size_t resample_frames;
+    int16_t audio_stage[AUDIO_STAGE_FRAMES * 2];
+    unsigned audio_staged;
+
+    // Cores using SET_AUDIO_CALLBACK are asked for audio from their own
+    // thread whenever less than a device period is queued. While it runs,
+    // everything audio_write touches is guarded by audio_lock.
+    SDL_Thread *audio_thread;
+    SDL_mutex *audio_lock;
+    SDL_atomic_t audio_quit;
+    Uint32 audio_low_water;
+    bool paused;
+
+    // Per-frame hashes of everything the core emitted, used for replay checks.
+    uint64_t video_hash;
+    uint64_t audio_hash;
+
+    // Netplay is running frames again after a rollback, nothing they emit
+    // may reach the screen, the speakers or the hashes.
+    bool replaying;
+};
 
-SDL_Window *g_win = NULL;
-static SDL_GLContext *g_ctx = NULL;
-static SDL_AudioDeviceID g_pcm = 0;
-static struct retro_frame_time_callback runloop_frame_time;
-static retro_usec_t runloop_frame_time_last = 0;
-static const uint8_t *g_kbd = NULL;
-static struct retro_audio_callback audio_callback;
+// The first context is the one shown and driven by the frontend modules
+// (movies, captures, screenshots, save RAM, the memory map), --compare runs
+// a second one headless next to it.
+#define FRONTEND_MAX 2
+static struct frontend g_frontends[FRONTEND_MAX];
+static struct frontend *const g_main = &g_frontends[0];
+
+// F12 requests a shot of the next frame, --screenshot-every takes one every
+// n frames. HW frames are read back asynchronously and handed to the worker
+// once their fence signals.
+static bool g_screenshot_pending = false;
+static unsigned g_screenshot_every = 0;
+static uint64_t g_video_frame = 0;
+static char g_readback_name[64];
+static unsigned g_readback_w, g_readback_h;
+
+// RAM watches from --watch, set up once the content has its memory map.
+#define WATCH_MAX 16
+static struct {
+    size_t addr, len;
+} g_watch_args[WATCH_MAX];
+static unsigned g_num_watch_args = 0;
+static uint64_t g_frame = 0;
+
+// RAM search filters from --search, run on system RAM at the given frames.
+#define SEARCH_MAX 16
+static struct {
+    uint64_t frame;
+    const char *name;
+    enum ramsearch_filter filter;
+    uint8_t value;
+} g_search_steps[SEARCH_MAX];
+static unsigned g_num_search_steps = 0, g_search_next = 0;
+
+static enum viewport_mode g_viewport_mode = VIEWPORT_ASPECT;
+static unsigned g_gl_check_interval = 60;
+
+// Disables vsync and audio output so the core runs as fast as it can.
+static bool g_unthrottled = false;
+
+// How swaps wait for the vblank, and the frame delay from --frame-delay.
+// The main context notes when a frame's draw ended and its swap began.
+static enum swap_policy g_swap_policy = SWAP_VSYNC;
+static bool g_frame_delay = false;
+static Uint64 g_swap_start;
+
+// Runs without a window, GL context or audio device.
+static bool g_headless = false;
+
+// Time spent inside the frontend callbacks, measured with --bench.
+static bool g_bench = false;
+static struct {
+    Uint64 run, video, audio, input, env;
+    Uint64 audio_calls, env_calls, gl_calls;
+} g_bench_ticks;
+
+// Frame statistics for monitoring from --telemetry. Video callback time is
+// taken out of the retro_run time, the last swap tells missed refreshes.
+static bool g_telemetry = false;
+static Uint64 g_telemetry_video;
+static Uint64 g_telemetry_last_swap;
+
+static uint64_t ticks_usec(Uint64 ticks) {
+    return ticks * 1000000 / SDL_GetPerformanceFrequency();
+}
 
-static float g_scale = 1;
-bool running = true;
+// Where the time to the first frame goes. The loader and audio phases run
+// on their own threads, the wait phases show how much of them the main
+// thread could not hide.
+enum startup_phase {
+    STARTUP_SDL,
+    STARTUP_CORE_OPEN,
+    STARTUP_CONTENT,
+    STARTUP_LOADER_WAIT,
+    STARTUP_CORE_INIT,
+    STARTUP_LOAD_GAME,
+    STARTUP_VIDEO,
+    STARTUP_AUDIO,
+    STARTUP_AUDIO_WAIT,
+    STARTUP_SETUP,
+    STARTUP_FIRST_FRAME,
+    STARTUP_PHASES
+};
+static bool g_startup_profile = false;
+static struct {
+    Uint64 start;
+    Uint64 ticks[STARTUP_PHASES];
+} g_startup;
 
-struct GVideo g_video  = {0};
-    
-struct GRetro g_retro;
+// Hash every frame, set by movies, golden files and --compare.
+static bool g_hash_frames = false;
 
+// Rollback netplay from --netplay, the main loop then runs frames through
+// netplay_frame and the local pad goes to port <player>.
+static bool g_netplay = false;
 
 struct keymap {
 	unsigned k;
@@ -40,15 +201,31 @@ static struct keymap g_binds[] = {
     { 0, 0 }
 };
 
-static unsigned g_joy[RETRO_DEVICE_ID_JOYPAD_R3+1] = { 0 };
-
 #define load_sym(V, S) do {\
-    if (!((*(void**)&V) = SDL_LoadFunction(g_retro.handle, #S))) \
+    if (!((*(void**)&V) = SDL_LoadFunction(fe->retro.handle, #S))) \
         die("Failed to load symbol '" #S "'': %s", SDL_GetError()); \
 	} while (0)
-#define load_retro_sym(S) load_sym(g_retro.S, S)
+#define load_retro_sym(S) load_sym(fe->retro.S, S)
 
 
+static void startup_add(enum startup_phase phase, Uint64 t0) {
+    g_startup.ticks[phase] += SDL_GetPerformanceCounter() - t0;
+}
+
+static void startup_report() {
+    static const char *names[STARTUP_PHASES] = {
+        "SDL_Init", "core open (loader thread)", "content read (loader thread)", "waiting for the loader",
+        "retro_init", "retro_load_game", "window, GL and shaders", "audio device (audio thread)",
+        "waiting for audio", "frontend setup", "first frame",
+    };
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+    unsigned i;
+
+    printf("startup: first frame after %.1f ms\r\n", (SDL_GetPerformanceCounter() - g_startup.start) * ms);
+    for (i = 0; i < STARTUP_PHASES; ++i)
+        printf("startup:   %-30s %8.1f ms\r\n", names[i], g_startup.ticks[i] * ms);
+}
+
 static void die(const char *fmt, ...) {
 	char buffer[4096];
 
@@ -64,13 +241,18 @@ static void die(const char *fmt, ...) {
 	exit(EXIT_FAILURE);
 }
 
-static void create_window(int width, int height) {
+static void create_window(struct frontend *fe, int width, int height) {
+    Uint64 t0;
+
     SDL_GL_SetAttribute(SDL_GL_RED_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_GREEN_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_BLUE_SIZE, 8);
     SDL_GL_SetAttribute(SDL_GL_ALPHA_SIZE, 8);
+#ifdef GL_DEBUG
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
 
-    switch (g_video.hw.context_type) {
+    switch (fe->video.hw.context_type) {
     case RETRO_HW_CONTEXT_OPENGL_CORE:
         //SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_CORE);
         break;
@@ -78,131 +260,187 @@ static void create_window(int width, int height) {
         SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_ES);
         break;
     case RETRO_HW_CONTEXT_OPENGL:
-        if (g_video.hw.version_major >= 3)
+        if (fe->video.hw.version_major >= 3)
             SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, SDL_GL_CONTEXT_PROFILE_COMPATIBILITY);
         break;
     default:
-        fprintf(stdout, "Unsupported hw context %i. (only OPENGL, OPENGL_CORE and OPENGLES2 supported)\r\n", g_video.hw.context_type);
-        //die("Unsupported hw context %i. (only OPENGL, OPENGL_CORE and OPENGLES2 supported)", g_video.hw.context_type);
+        fprintf(stdout, "Unsupported hw context %i. (only OPENGL, OPENGL_CORE and OPENGLES2 supported)\r\n", fe->video.hw.context_type);
+        //die("Unsupported hw context %i. (only OPENGL, OPENGL_CORE and OPENGLES2 supported)", fe->video.hw.context_type);
     }
-    g_win = SDL_CreateWindow("sdlarch", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_FULLSCREEN);
+    fe->win = SDL_CreateWindow("sdlarch", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, width, height, SDL_WINDOW_OPENGL | SDL_WINDOW_FULLSCREEN);
 
-	if (!g_win)
+	if (!fe->win)
         die("Failed to create window: %s", SDL_GetError());
 
-    g_ctx = SDL_GL_CreateContext(g_win);
+    fe->ctx = SDL_GL_CreateContext(fe->win);
 
-    if (!g_ctx)
+    if (!fe->ctx)
         die("Failed to create OpenGL context: %s", SDL_GetError());
 
-    if (g_video.hw.context_type == RETRO_HW_CONTEXT_OPENGLES2) {
-        if (!gladLoadGLES2Loader((GLADloadproc)SDL_GL_GetProcAddress))
-            die("Failed to initialize glad.");
-    } else {
-        if (!gladLoadGLLoader((GLADloadproc)SDL_GL_GetProcAddress))
-            die("Failed to initialize glad.");
-    }
+    t0 = SDL_GetPerformanceCounter();
+    if (!gl_loader_init((GLADloadproc)SDL_GL_GetProcAddress, fe->video.hw.context_type == RETRO_HW_CONTEXT_OPENGLES2))
+        die("Failed to load the GL functions.");
+    printf("GL functions loaded in %.3f ms\r\n",
+        (SDL_GetPerformanceCounter() - t0) * 1000.0 / SDL_GetPerformanceFrequency());
+    video_bind(&fe->video, fe->win);
 
     fprintf(stderr, "GL_SHADING_LANGUAGE_VERSION: %s\n", glGetString(GL_SHADING_LANGUAGE_VERSION));
     fprintf(stderr, "GL_VERSION: %s\n", glGetString(GL_VERSION));
 
-    video_shader_init();
-
-    SDL_GL_SetSwapInterval(1);
-    SDL_GL_SwapWindow(g_win); // make apitrace output nicer
-}
-
+    gl_debug_init(g_gl_check_interval);
 
-static void resize_to_aspect(double ratio, int sw, int sh, int *dw, int *dh) {
-	*dw = sw;
-	*dh = sh;
-
-	if (ratio <= 0)
-		ratio = (double)sw / sh;
-
-	if ((float)sw / sh < 1)
-		*dw = *dh * ratio;
-	else
-		*dh = *dw / ratio;
+    video_shader_init();
+    video_set_viewport_mode(g_viewport_mode);
+
+    // Adaptive vsync is -1, drivers without it refuse it.
+    if (g_unthrottled || g_swap_policy == SWAP_OFF) {
+        SDL_GL_SetSwapInterval(0);
+    } else if (g_swap_policy != SWAP_ADAPTIVE || SDL_GL_SetSwapInterval(-1) < 0) {
+        if (g_swap_policy == SWAP_ADAPTIVE)
+            printf("Adaptive vsync is not supported, using vsync\r\n");
+        SDL_GL_SetSwapInterval(1);
+    }
+    SDL_GL_SwapWindow(fe->win); // make apitrace output nicer
 }
 
 
-static void video_configure(const struct retro_game_geometry *geom) {
-	int nwidth, nheight;
-
-	resize_to_aspect(geom->aspect_ratio, geom->base_width * 1, geom->base_height * 1, &nwidth, &nheight);
+static bool video_set_pixel_format(struct frontend *fe, unsigned format);
 
-	nwidth *= g_scale;
-	nheight *= g_scale;
-    printf("nwidth: %d\tnheight: %d\r\n", nwidth, nheight);
+static void video_configure(struct frontend *fe, const struct retro_game_geometry *geom) {
+	printf("base_width: %d\tbase_height: %d\r\n", geom->base_width, geom->base_height);
 	printf("max_width: %d\tmax_height: %d\r\n", geom->max_width, geom->max_height);
 
-	if (!g_win)
-		create_window(geom->max_width, geom->max_height);
-
-	if (g_video.tex_id)
-		glDeleteTextures(1, &g_video.tex_id);
-
-	g_video.tex_id = 0;
+	if (fe->headless) {
+		if (!fe->video.pixfmt)
+			video_set_pixel_format(fe, RETRO_PIXEL_FORMAT_0RGB1555);
+		return;
+	}
 
-	if (!g_video.pixfmt)
-		g_video.pixfmt = GL_UNSIGNED_SHORT_5_5_5_1;
+	if (!fe->win)
+		create_window(fe, geom->max_width, geom->max_height);
 
+	if (!fe->video.pixfmt) {
+		fe->video.pixfmt = GL_UNSIGNED_SHORT_5_5_5_1;
+		fe->video.pixtype = GL_BGRA;
+		fe->video.bpp = sizeof(uint16_t);
+	}
 
-	glGenTextures(1, &g_video.tex_id);
+	// The texture object is kept, video_init only reallocates its storage.
+	if (!fe->video.tex_id)
+		glGenTextures(1, &fe->video.tex_id);
 
-	if (!g_video.tex_id)
+	if (!fe->video.tex_id)
 		die("Failed to create the video texture");
 
-	g_video.pitch = geom->base_width * g_video.bpp;
-	g_video.tex_w = geom->max_width;
-	g_video.tex_h = geom->max_height;
-	g_video.clip_w = geom->base_width;
-	g_video.clip_h = geom->base_height;
+	fe->video.pitch = geom->base_width * fe->video.bpp;
+	fe->video.tex_w = geom->max_width;
+	fe->video.tex_h = geom->max_height;
+	fe->video.clip_w = geom->base_width;
+	fe->video.clip_h = geom->base_height;
 
-    video_init(geom, nwidth, nheight, 0);
+    video_init(geom);
 }
 
 
-static bool video_set_pixel_format(unsigned format) {
-	if (g_video.tex_id)
+static bool video_set_pixel_format(struct frontend *fe, unsigned format) {
+	if (fe->video.tex_id)
 		die("Tried to change pixel format after initialization.");
 
 	switch (format) {
 	case RETRO_PIXEL_FORMAT_0RGB1555:
         printf("GL_UNSIGNED_SHORT_5_5_5_1\r\n");
-		g_video.pixfmt = GL_UNSIGNED_SHORT_5_5_5_1;
-		g_video.pixtype = GL_BGRA;
-		g_video.bpp = sizeof(uint16_t);
+		fe->video.pixfmt = GL_UNSIGNED_SHORT_5_5_5_1;
+		fe->video.pixtype = GL_BGRA;
+		fe->video.bpp = sizeof(uint16_t);
 		break;
 	case RETRO_PIXEL_FORMAT_XRGB8888:
         printf("GL_UNSIGNED_INT_8_8_8_8_REV\r\n");
-		g_video.pixfmt = GL_UNSIGNED_INT_8_8_8_8_REV;
-		g_video.pixtype = GL_BGRA;
-		g_video.bpp = sizeof(uint32_t);
+		fe->video.pixfmt = GL_UNSIGNED_INT_8_8_8_8_REV;
+		fe->video.pixtype = GL_BGRA;
+		fe->video.bpp = sizeof(uint32_t);
 		break;
 	case RETRO_PIXEL_FORMAT_RGB565:
         printf("GL_UNSIGNED_SHORT_5_6_5\r\n");
-		g_video.pixfmt  = GL_UNSIGNED_SHORT_5_6_5;
-		g_video.pixtype = GL_RGB;
-		g_video.bpp = sizeof(uint16_t);
+		fe->video.pixfmt  = GL_UNSIGNED_SHORT_5_6_5;
+		fe->video.pixtype = GL_RGB;
+		fe->video.bpp = sizeof(uint16_t);
 		break;
 	default:
 		die("Unknown pixel type %u", format);
 	}
 
+	fe->pixel_format = format;
 	return true;
 }
 
-static void video_deinit() {
-	if (g_video.tex_id)
-		glDeleteTextures(1, &g_video.tex_id);
+// SET_GEOMETRY only moves the visible part of the max sized texture, so it
+// costs a layout update.
+static bool video_update_geometry(struct frontend *fe, const struct retro_game_geometry *geom) {
+	struct retro_game_geometry g = *geom;
+
+	// The max size can only change through SET_SYSTEM_AV_INFO.
+	g.max_width = fe->av.geometry.max_width;
+	g.max_height = fe->av.geometry.max_height;
+	if (g.base_width > g.max_width)
+		g.base_width = g.max_width;
+	if (g.base_height > g.max_height)
+		g.base_height = g.max_height;
+
+	if (g.base_width == fe->av.geometry.base_width && g.base_height == fe->av.geometry.base_height &&
+	    g.aspect_ratio == fe->av.geometry.aspect_ratio)
+		return true;
+
+	fe->av.geometry = g;
+
+	if (!fe->headless)
+		video_set_geometry(&g);
+
+	return true;
+}
+
+static void video_deinit(struct frontend *fe) {
+	if (fe->video.tex_id)
+		glDeleteTextures(1, &fe->video.tex_id);
+
+	fe->video.tex_id = 0;
+}
+
+
+static void audio_lock(struct frontend *fe) {
+    if (fe->audio_lock)
+        SDL_LockMutex(fe->audio_lock);
+}
+
+static void audio_unlock(struct frontend *fe) {
+    if (fe->audio_lock)
+        SDL_UnlockMutex(fe->audio_lock);
+}
+
+// Switches the resampler to a new core rate, the device is left alone.
+static void audio_set_rate(struct frontend *fe, double frequency) {
+    resampler_free(fe->resampler);
+    fe->resampler = NULL;
 
-	g_video.tex_id = 0;
+    if (frequency == fe->audio_rate)
+        return;
+
+    fe->resampler = resampler_new(frequency, fe->audio_rate, g_resampler_quality);
+    if (!fe->resampler)
+        die("Failed to create a resampler from %.0f Hz to %d Hz", frequency, fe->audio_rate);
+
+    printf("Resampling audio from %.0f Hz to %d Hz (%s)\r\n", frequency, fe->audio_rate,
+        resampler_quality_name(g_resampler_quality));
 }
 
+// Opening the device can take tens of milliseconds, so it runs on its own
+// thread while the window and GL context are created. SDL_Init is not
+// thread-safe, the main thread initializes the subsystem first, and a
+// failure is left for it to report.
+static char g_audio_error[256];
 
-static void audio_init(int frequency) {
+static int audio_open(void *data) {
+    struct frontend *fe = data;
+    Uint64 t0 = SDL_GetPerformanceCounter();
     SDL_AudioSpec desired;
     SDL_AudioSpec obtained;
 
@@ -210,32 +448,234 @@ static void audio_init(int frequency) {
     SDL_zero(obtained);
 
     desired.format = AUDIO_S16;
-    desired.freq   = frequency;
+    desired.freq   = AUDIO_DEVICE_RATE;
     desired.channels = 2;
     desired.samples = 4096;
 
-    g_pcm = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, 0);
-    if (!g_pcm)
-        die("Failed to open playback device: %s", SDL_GetError());
+    // Core rates like 32040 Hz are converted by our own resampler, SDL
+    // would otherwise pick its own converter or fail to open the device.
+    fe->pcm = SDL_OpenAudioDevice(NULL, 0, &desired, &obtained, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!fe->pcm) {
+        // SDL errors are per thread.
+        snprintf(g_audio_error, sizeof(g_audio_error), "%s", SDL_GetError());
+        return -1;
+    }
+
+    fe->audio_rate = obtained.freq;
+    fe->audio_low_water = obtained.size;
+    startup_add(STARTUP_AUDIO, t0);
+    return 0;
+}
+
+// Returns the thread opening the device, NULL if it was opened right away.
+static SDL_Thread *audio_open_async(struct frontend *fe) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    SDL_Thread *thread;
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0)
+        die("Failed to initialize SDL audio: %s", SDL_GetError());
+    startup_add(STARTUP_SDL, t0);
+
+    thread = SDL_CreateThread(audio_open, "audio open", fe);
+    if (!thread)
+        audio_open(fe);
+    return thread;
+}
+
+// Waits for the device and starts playback.
+static void audio_init(struct frontend *fe, double frequency, SDL_Thread *opener) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    if (opener)
+        SDL_WaitThread(opener, NULL);
+    startup_add(STARTUP_AUDIO_WAIT, t0);
 
-    SDL_PauseAudioDevice(g_pcm, 0);
+    if (!fe->pcm)
+        die("Failed to open playback device: %s", g_audio_error);
+
+    printf("Audio device opened at %d Hz\r\n", fe->audio_rate);
+    audio_set_rate(fe, frequency);
+    SDL_PauseAudioDevice(fe->pcm, 0);
 
     // Let the core know that the audio device has been initialized.
-    if (audio_callback.set_state) {
-        audio_callback.set_state(true);
+    if (fe->audio_callback.set_state) {
+        fe->audio_callback.set_state(true);
     }
 }
 
 
-static void audio_deinit() {
-    SDL_CloseAudioDevice(g_pcm);
+// SET_SYSTEM_AV_INFO: the texture is only reallocated when it has to grow,
+// and only the resampler is rebuilt for a new sample rate.
+static bool av_info_update(struct frontend *fe, const struct retro_system_av_info *av) {
+    bool new_rate = av->timing.sample_rate != fe->av.timing.sample_rate;
+
+    if (av->geometry.max_width > (unsigned)fe->video.tex_w || av->geometry.max_height > (unsigned)fe->video.tex_h) {
+        fe->av = *av;
+        video_configure(fe, &av->geometry);
+    } else {
+        fe->av.timing = av->timing;
+        fe->av.geometry.max_width = av->geometry.max_width;
+        fe->av.geometry.max_height = av->geometry.max_height;
+        video_update_geometry(fe, &av->geometry);
+    }
+
+    // The audio thread of a core with an audio callback feeds both.
+    if (new_rate) {
+        audio_lock(fe);
+        if (fe->pcm)
+            audio_set_rate(fe, av->timing.sample_rate);
+        if (fe == g_main)
+            recorder_set_sample_rate(av->timing.sample_rate);
+        audio_unlock(fe);
+    }
+
+    return true;
 }
 
-static size_t audio_write(const int16_t *buf, unsigned frames) {
-    SDL_QueueAudio(g_pcm, buf, sizeof(*buf) * frames * 2);
+static size_t audio_output(struct frontend *fe, const int16_t *buf, unsigned frames) {
+    if (fe == g_main)
+        recorder_audio(buf, frames);
+
+    // --bench keeps the whole output path so it gets measured, and drops
+    // whatever piles up.
+    if ((g_unthrottled && !g_bench) || !fe->pcm)
+        return frames;
+
+    if (g_bench && SDL_GetQueuedAudioSize(fe->pcm) > AUDIO_DEVICE_RATE * 4)
+        SDL_ClearQueuedAudio(fe->pcm);
+
+    if (fe->resampler) {
+        size_t max = resampler_max_output(fe->resampler, frames);
+
+        if (max > fe->resample_frames) {
+            int16_t *out = realloc(fe->resample_buf, max * 2 * sizeof(int16_t));
+
+            if (!out)
+                return frames;
+
+            fe->resample_buf = out;
+            fe->resample_frames = max;
+        }
+
+        SDL_QueueAudio(fe->pcm, fe->resample_buf, sizeof(int16_t) * 2 *
+            resampler_process(fe->resampler, buf, frames, fe->resample_buf));
+        return frames;
+    }
+
+    SDL_QueueAudio(fe->pcm, buf, sizeof(*buf) * frames * 2);
     return frames;
 }
 
+static size_t audio_write(struct frontend *fe, const int16_t *buf, unsigned frames) {
+    if (g_hash_frames)
+        fe->audio_hash = hash64(buf, sizeof(*buf) * frames * 2, fe->audio_hash);
+
+    return audio_output(fe, buf, frames);
+}
+
+static void audio_flush(struct frontend *fe) {
+    unsigned frames;
+
+    audio_lock(fe);
+    frames = fe->audio_staged;
+    fe->audio_staged = 0;
+    if (frames)
+        audio_output(fe, fe->audio_stage, frames);
+    audio_unlock(fe);
+}
+
+static int audio_thread(void *data) {
+    struct frontend *fe = data;
+    // Bytes per millisecond at the device rate.
+    Uint32 rate = fe->audio_rate * 4 / 1000;
+    bool paused;
+
+    while (!SDL_AtomicGet(&fe->audio_quit)) {
+        Uint32 queued = SDL_GetQueuedAudioSize(fe->pcm);
+
+        if (queued >= fe->audio_low_water) {
+            // Wake up again once about half of the surplus has played.
+            Uint32 ms = (queued - fe->audio_low_water) / rate / 2;
+            SDL_Delay(ms ? ms : 1);
+            continue;
+        }
+
+        SDL_LockMutex(fe->audio_lock);
+        paused = fe->paused;
+        if (!paused) {
+            fe->audio_callback.callback();
+            audio_flush(fe);
+        }
+        SDL_UnlockMutex(fe->audio_lock);
+
+        // Nothing to play yet, or paused with a drained queue.
+        if (paused || SDL_GetQueuedAudioSize(fe->pcm) <= queued)
+            SDL_Delay(paused ? 10 : 1);
+    }
+
+    return 0;
+}
+
+// Runs without the thread when output must be reproducible: headless,
+// unthrottled, hashed and netplay runs keep calling the core once per frame.
+static void audio_thread_start(struct frontend *fe) {
+    if (!fe->audio_callback.callback || !fe->pcm || g_unthrottled || g_hash_frames || g_netplay)
+        return;
+
+    fe->audio_lock = SDL_CreateMutex();
+    if (!fe->audio_lock)
+        die("Failed to create the audio lock: %s", SDL_GetError());
+
+    SDL_AtomicSet(&fe->audio_quit, 0);
+    fe->audio_thread = SDL_CreateThread(audio_thread, "audio", fe);
+    if (!fe->audio_thread)
+        die("Failed to create the audio thread: %s", SDL_GetError());
+}
+
+static void audio_thread_stop(struct frontend *fe) {
+    if (!fe->audio_thread)
+        return;
+
+    SDL_AtomicSet(&fe->audio_quit, 1);
+    SDL_WaitThread(fe->audio_thread, NULL);
+    fe->audio_thread = NULL;
+
+    SDL_DestroyMutex(fe->audio_lock);
+    fe->audio_lock = NULL;
+}
+
+// Stops the device and tells the core, the audio thread idles until the
+// frontend resumes.
+static void audio_set_paused(struct frontend *fe, bool paused) {
+    audio_lock(fe);
+    fe->paused = paused;
+    if (fe->pcm) {
+        SDL_PauseAudioDevice(fe->pcm, paused);
+        if (fe->audio_callback.set_state)
+            fe->audio_callback.set_state(!paused);
+    }
+    audio_unlock(fe);
+}
+
+static void audio_deinit(struct frontend *fe) {
+    audio_thread_stop(fe);
+
+    if (!fe->pcm)
+        return;
+
+    if (fe->audio_callback.set_state)
+        fe->audio_callback.set_state(false);
+
+    SDL_CloseAudioDevice(fe->pcm);
+    fe->pcm = 0;
+
+    resampler_free(fe->resampler);
+    fe->resampler = NULL;
+    free(fe->resample_buf);
+    fe->resample_buf = NULL;
+    fe->resample_frames = 0;
+}
+
 
 static void core_log(enum retro_log_level level, const char *fmt, ...) {
 	char buffer[4096] = {0};
@@ -256,11 +696,7 @@ static void core_log(enum retro_log_level level, const char *fmt, ...) {
 		exit(EXIT_FAILURE);
 }
 
-static uintptr_t core_get_current_framebuffer() {
-    return g_video.fbo_id;
-}
-
-static bool core_environment(unsigned cmd, void *data) {
+static bool core_environment(struct frontend *fe, unsigned cmd, void *data) {
 	bool *bval;
 
 	switch (cmd) {
@@ -282,26 +718,35 @@ static bool core_environment(unsigned cmd, void *data) {
         }
         core_log(RETRO_LOG_DEBUG, "CORE DEBYG+ adksjhkahdkj");
 
-		return video_set_pixel_format(*fmt);
+		return video_set_pixel_format(fe, *fmt);
 	}
     case RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE:
         return false;
     case RETRO_ENVIRONMENT_SET_HW_RENDER: {
         struct retro_hw_render_callback *hw = (struct retro_hw_render_callback*)data;
-        hw->get_current_framebuffer = core_get_current_framebuffer;
+        hw->get_current_framebuffer = fe->callbacks->get_current_framebuffer;
         hw->get_proc_address = (retro_hw_get_proc_address_t)SDL_GL_GetProcAddress;
-        g_video.hw = *hw;
+        fe->video.hw = *hw;
         return true;
     }
     case RETRO_ENVIRONMENT_SET_FRAME_TIME_CALLBACK: {
         const struct retro_frame_time_callback *frame_time =
             (const struct retro_frame_time_callback*)data;
-        runloop_frame_time = *frame_time;
+        fe->frame_time = *frame_time;
         break;
     }
+    case RETRO_ENVIRONMENT_SET_GEOMETRY:
+        return video_update_geometry(fe, (const struct retro_game_geometry*)data);
+    case RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO:
+        return av_info_update(fe, (const struct retro_system_av_info*)data);
+    case RETRO_ENVIRONMENT_SET_MEMORY_MAPS:
+        // Watches and cheats only look at the main context.
+        return fe != g_main || memmap_set((const struct retro_memory_map*)data);
     case RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK: {
         struct retro_audio_callback *audio_cb = (struct retro_audio_callback*)data;
-        audio_callback = *audio_cb;
+        audio_lock(fe);
+        fe->audio_callback = *audio_cb;
+        audio_unlock(fe);
         return true;
     }
 	default:
@@ -313,54 +758,351 @@ static bool core_environment(unsigned cmd, void *data) {
 }
 
 
-static void core_video_refresh(const void *data, unsigned width, unsigned height, size_t pitch) {
+static void screenshot_poll(bool wait) {
+    const void *data;
+
+    if (!g_readback_name[0])
+        return;
+
+    data = video_readback_map(wait);
+    if (data)
+        screenshot_write_rgba(g_readback_name, data, g_readback_w, g_readback_h);
+    else if (!wait)
+        return;
+
+    video_readback_end();
+    g_readback_name[0] = '\0';
+}
+
+static void screenshot_frame(struct frontend *fe, const void *data, unsigned width, unsigned height, size_t pitch) {
+    uint64_t frame = g_video_frame++;
+    char name[64];
+
+    screenshot_poll(false);
+
+    if (!g_screenshot_pending && !(g_screenshot_every && frame % g_screenshot_every == 0))
+        return;
+
+    // Dupes carry no pixels, a requested shot waits for the next real frame.
+    if (!data)
+        return;
+
+    g_screenshot_pending = false;
+    snprintf(name, sizeof(name), "sdlarch-%06llu.png", (unsigned long long)frame);
+
+    if (data != RETRO_HW_FRAME_BUFFER_VALID) {
+        screenshot_write(name, data, width, height, pitch, fe->pixel_format);
+        return;
+    }
+
+    // The core rendered into the back buffer, read it before it gets drawn over.
+    if (fe->headless || g_readback_name[0] || !video_readback_start(width, height)) {
+        fprintf(stderr, "screenshot: could not read back HW frame %llu\n", (unsigned long long)frame);
+        return;
+    }
+
+    snprintf(g_readback_name, sizeof(g_readback_name), "%s", name);
+    g_readback_w = width;
+    g_readback_h = height;
+}
+
+static void core_video_refresh(struct frontend *fe, const void *data, unsigned width, unsigned height, size_t pitch) {
+    Uint64 t0, t1, t2;
+
+    if (fe->replaying)
+        return;
+
+    if (fe == g_main) {
+        screenshot_frame(fe, data, width, height, pitch);
+        recorder_video(data, width, height, pitch);
+    }
+
+    if (g_hash_frames && data && data != RETRO_HW_FRAME_BUFFER_VALID) {
+        const uint8_t *row = (const uint8_t*)data;
+        unsigned y;
+
+        // Hash only the visible part of each row, the padding up to pitch
+        // is undefined.
+        for (y = 0; y < height; ++y, row += pitch)
+            fe->video_hash = hash64(row, width * fe->video.bpp, fe->video_hash);
+    }
+
+    if (fe->headless)
+        return;
+
+    if (!g_telemetry || fe != g_main) {
+        video_draw(data, width, height, pitch);
+        if (fe == g_main)
+            g_swap_start = SDL_GetPerformanceCounter();
+        SDL_GL_SwapWindow(fe->win);
+        return;
+    }
+
+    t0 = SDL_GetPerformanceCounter();
     video_draw(data, width, height, pitch);
-    SDL_GL_SwapWindow(g_win);
+    t1 = g_swap_start = SDL_GetPerformanceCounter();
+    SDL_GL_SwapWindow(fe->win);
+    t2 = SDL_GetPerformanceCounter();
+
+    telemetry_record(TELEMETRY_UPLOAD, ticks_usec(t1 - t0));
+    telemetry_record(TELEMETRY_SWAP, ticks_usec(t2 - t1));
+    if (!data)
+        telemetry_count(TELEMETRY_DUPLICATED, 1);
+
+    // With vsync every swap takes one refresh, a longer gap skipped some.
+    if (!g_unthrottled && g_swap_policy != SWAP_OFF && g_telemetry_last_swap && fe->av.timing.fps > 0) {
+        double periods = ticks_usec(t2 - g_telemetry_last_swap) * fe->av.timing.fps / 1e6;
+
+        if (periods >= 1.5)
+            telemetry_count(TELEMETRY_DROPPED, (unsigned)(periods - 0.5));
+    }
+    g_telemetry_last_swap = t2;
+    g_telemetry_video += t2 - t0;
 }
 
 
-static void core_input_poll(void) {
+// Reads the keyboard, or the movie being played, into the first pad.
+static void input_read(struct frontend *fe) {
+    const uint8_t *kbd = SDL_GetKeyboardState(NULL);
 	int i;
-    g_kbd = SDL_GetKeyboardState(NULL);
 
 	for (i = 0; g_binds[i].k || g_binds[i].rk; ++i)
-        g_joy[g_binds[i].rk] = g_kbd[g_binds[i].k];
+        fe->joy[0][g_binds[i].rk] = kbd[g_binds[i].k];
+
+    if (movie_get_mode() == MOVIE_PLAYBACK) {
+        uint16_t input = movie_input();
 
-    if (g_kbd[SDL_SCANCODE_ESCAPE])
-        running = false;
+        for (i = 0; i <= RETRO_DEVICE_ID_JOYPAD_R3; ++i)
+            fe->joy[0][i] = (input >> i) & 1;
+    }
+
+    if (kbd[SDL_SCANCODE_ESCAPE])
+        fe->running = false;
 }
 
+static void core_input_poll(struct frontend *fe) {
+    // A second context replays what the main one read this frame.
+    if (fe != g_main) {
+        memcpy(fe->joy, g_main->joy, sizeof(fe->joy));
+        return;
+    }
 
-static int16_t core_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
-	if (port || index || device != RETRO_DEVICE_JOYPAD)
+    // Netplay reads the keyboard once per frame and sets both pads itself.
+    if (!g_netplay)
+        input_read(fe);
+}
+
+
+static int16_t core_input_state(struct frontend *fe, unsigned port, unsigned device, unsigned index, unsigned id) {
+	if (port >= NETPLAY_PLAYERS || index || device != RETRO_DEVICE_JOYPAD ||
+	    id > RETRO_DEVICE_ID_JOYPAD_R3)
 		return 0;
 
-	return g_joy[id];
+	return fe->joy[port][id];
+}
+
+
+static void core_audio_sample(struct frontend *fe, int16_t left, int16_t right) {
+	if (fe->replaying)
+		return;
+
+	audio_lock(fe);
+	fe->audio_stage[fe->audio_staged * 2 + 0] = left;
+	fe->audio_stage[fe->audio_staged * 2 + 1] = right;
+
+	// Hashed as they arrive, so movies and golden files keep matching.
+	if (g_hash_frames)
+		fe->audio_hash = hash64(fe->audio_stage + fe->audio_staged * 2, sizeof(int16_t) * 2, fe->audio_hash);
+
+	if (++fe->audio_staged == AUDIO_STAGE_FRAMES)
+		audio_flush(fe);
+	audio_unlock(fe);
 }
 
 
-static void core_audio_sample(int16_t left, int16_t right) {
-	int16_t buf[2] = {left, right};
-	audio_write(buf, 1);
+static size_t core_audio_sample_batch(struct frontend *fe, const int16_t *data, size_t frames) {
+	size_t ret;
+
+	if (fe->replaying)
+		return frames;
+
+	// Keep the order of samples from cores mixing both callbacks.
+	audio_lock(fe);
+	audio_flush(fe);
+	ret = audio_write(fe, data, frames);
+	audio_unlock(fe);
+
+	return ret;
 }
 
+// Callbacks bound to context n. The implementations above get a constant
+// context address, which the compiler folds into their field accesses.
+#define FRONTEND_CALLBACKS(n) \
+static bool environment_##n(unsigned cmd, void *data) { \
+    return core_environment(&g_frontends[n], cmd, data); \
+} \
+static void video_refresh_##n(const void *data, unsigned width, unsigned height, size_t pitch) { \
+    core_video_refresh(&g_frontends[n], data, width, height, pitch); \
+} \
+static void input_poll_##n(void) { \
+    core_input_poll(&g_frontends[n]); \
+} \
+static int16_t input_state_##n(unsigned port, unsigned device, unsigned index, unsigned id) { \
+    return core_input_state(&g_frontends[n], port, device, index, id); \
+} \
+static void audio_sample_##n(int16_t left, int16_t right) { \
+    core_audio_sample(&g_frontends[n], left, right); \
+} \
+static size_t audio_sample_batch_##n(const int16_t *data, size_t frames) { \
+    return core_audio_sample_batch(&g_frontends[n], data, frames); \
+} \
+static uintptr_t get_current_framebuffer_##n(void) { \
+    return g_frontends[n].video.fbo_id; \
+}
 
-static size_t core_audio_sample_batch(const int16_t *data, size_t frames) {
-	return audio_write(data, frames);
+#define FRONTEND_CALLBACKS_ENTRY(n) { \
+    environment_##n, video_refresh_##n, input_poll_##n, input_state_##n, \
+    audio_sample_##n, audio_sample_batch_##n, get_current_framebuffer_##n, \
 }
 
+FRONTEND_CALLBACKS(0)
+FRONTEND_CALLBACKS(1)
+
+static const struct frontend_callbacks g_callbacks[FRONTEND_MAX] = {
+    FRONTEND_CALLBACKS_ENTRY(0),
+    FRONTEND_CALLBACKS_ENTRY(1),
+};
 
-static void core_load(const char *sofile) {
-	void (*set_environment)(retro_environment_t) = NULL;
-	void (*set_video_refresh)(retro_video_refresh_t) = NULL;
-	void (*set_input_poll)(retro_input_poll_t) = NULL;
-	void (*set_input_state)(retro_input_state_t) = NULL;
-	void (*set_audio_sample)(retro_audio_sample_t) = NULL;
-	void (*set_audio_sample_batch)(retro_audio_sample_batch_t) = NULL;
-	memset(&g_retro, 0, sizeof(g_retro));
-    g_retro.handle = SDL_LoadObject(sofile);
 
-	if (!g_retro.handle)
+// Timing wrappers, only installed on the main context with --bench so the
+// regular callbacks stay free of any measurement overhead.
+static bool bench_environment(unsigned cmd, void *data) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    bool ret = core_environment(g_main, cmd, data);
+    g_bench_ticks.env += SDL_GetPerformanceCounter() - t0;
+    g_bench_ticks.env_calls++;
+    return ret;
+}
+
+static void bench_video_refresh(const void *data, unsigned width, unsigned height, size_t pitch) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    core_video_refresh(g_main, data, width, height, pitch);
+    g_bench_ticks.video += SDL_GetPerformanceCounter() - t0;
+
+    if (!g_main->headless)
+        g_bench_ticks.gl_calls += video_gl_calls();
+}
+
+static void bench_input_poll(void) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    core_input_poll(g_main);
+    g_bench_ticks.input += SDL_GetPerformanceCounter() - t0;
+}
+
+static int16_t bench_input_state(unsigned port, unsigned device, unsigned index, unsigned id) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    int16_t ret = core_input_state(g_main, port, device, index, id);
+    g_bench_ticks.input += SDL_GetPerformanceCounter() - t0;
+    return ret;
+}
+
+// Per-sample calls only store into the staging buffer, timing each one
+// would cost more than the call. Their real work is timed in audio_flush.
+static void bench_audio_sample(int16_t left, int16_t right) {
+    core_audio_sample(g_main, left, right);
+    g_bench_ticks.audio_calls++;
+}
+
+static size_t bench_audio_sample_batch(const int16_t *data, size_t frames) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+    size_t ret = core_audio_sample_batch(g_main, data, frames);
+    g_bench_ticks.audio += SDL_GetPerformanceCounter() - t0;
+    g_bench_ticks.audio_calls++;
+    return ret;
+}
+
+static const struct frontend_callbacks g_bench_callbacks = {
+    bench_environment, bench_video_refresh, bench_input_poll, bench_input_state,
+    bench_audio_sample, bench_audio_sample_batch, get_current_framebuffer_0,
+};
+
+static void bench_report(Uint64 frames) {
+    double us = 1e6 / SDL_GetPerformanceFrequency() / (frames ? frames : 1);
+    Uint64 frontend = g_bench_ticks.video + g_bench_ticks.audio + g_bench_ticks.input + g_bench_ticks.env;
+
+    printf("bench: per frame %.2f us in retro_run, %.2f us of it in frontend callbacks\r\n",
+        g_bench_ticks.run * us, frontend * us);
+    printf("bench: video %.2f us, audio %.2f us (%.1f calls), input %.2f us, env %.2f us (%.1f calls)\r\n",
+        g_bench_ticks.video * us, g_bench_ticks.audio * us, (double)g_bench_ticks.audio_calls / (frames ? frames : 1),
+        g_bench_ticks.input * us, g_bench_ticks.env * us, (double)g_bench_ticks.env_calls / (frames ? frames : 1));
+    printf("bench: %.1f GL calls per frame\r\n", (double)g_bench_ticks.gl_calls / (frames ? frames : 1));
+}
+
+// Resamples a minute of audio from common core rates to the device rate in
+// frame sized chunks, with every quality and with SDL_AudioStream.
+static void bench_resampler(void) {
+    static const int rates[] = { 32040, 44100 };
+    const unsigned seconds = 60;
+    double freq = SDL_GetPerformanceFrequency();
+    unsigned r, q;
+
+    for (r = 0; r < sizeof(rates) / sizeof(rates[0]); ++r) {
+        size_t total = (size_t)rates[r] * seconds, chunk = rates[r] / 60, i;
+        int16_t *in = malloc(total * 2 * sizeof(int16_t));
+        int16_t *out = malloc((chunk * 2 + 64) * 2 * sizeof(int16_t));
+        Uint64 t0;
+
+        if (!in || !out)
+            die("Out of memory");
+
+        // A 50 Hz to 10 kHz sweep, so no kernel sees only silence.
+        for (i = 0; i < total; ++i)
+            in[i * 2] = in[i * 2 + 1] = 12000 * SDL_sin(2 * M_PI * (50.0 + 10000.0 * i / total) * i / rates[r]);
+
+        for (q = RESAMPLER_CUBIC; q <= RESAMPLER_SINC_HQ; ++q) {
+            struct resampler *rs = resampler_new(rates[r], AUDIO_DEVICE_RATE, q);
+
+            if (!rs)
+                die("Failed to create a resampler");
+
+            t0 = SDL_GetPerformanceCounter();
+            for (i = 0; i + chunk <= total; i += chunk)
+                resampler_process(rs, in + i * 2, chunk, out);
+            printf("resampler: %-15s %d -> %d Hz: %.2f ms per second of audio\r\n", resampler_quality_name(q),
+                rates[r], AUDIO_DEVICE_RATE, (SDL_GetPerformanceCounter() - t0) * 1000.0 / freq / seconds);
+            resampler_free(rs);
+        }
+
+#if SDL_VERSION_ATLEAST(2, 0, 7)
+        {
+            SDL_AudioStream *stream = SDL_NewAudioStream(AUDIO_S16, 2, rates[r], AUDIO_S16, 2, AUDIO_DEVICE_RATE);
+
+            if (!stream)
+                die("Failed to create an audio stream: %s", SDL_GetError());
+
+            t0 = SDL_GetPerformanceCounter();
+            for (i = 0; i + chunk <= total; i += chunk) {
+                SDL_AudioStreamPut(stream, in + i * 2, chunk * 2 * sizeof(int16_t));
+                SDL_AudioStreamGet(stream, out, (chunk * 2 + 64) * 2 * sizeof(int16_t));
+            }
+            printf("resampler: %-15s %d -> %d Hz: %.2f ms per second of audio\r\n", "SDL_AudioStream",
+                rates[r], AUDIO_DEVICE_RATE, (SDL_GetPerformanceCounter() - t0) * 1000.0 / freq / seconds);
+            SDL_FreeAudioStream(stream);
+        }
+#endif
+
+        free(in);
+        free(out);
+    }
+}
+
+// Opens the core and resolves its symbols. Nothing in the core runs yet, so
+// this is safe on the loader thread.
+static void core_open(struct frontend *fe, const char *sofile) {
+	memset(&fe->retro, 0, sizeof(fe->retro));
+    fe->retro.handle = SDL_LoadObject(sofile);
+
+	if (!fe->retro.handle)
         die("Failed to load core: %s", SDL_GetError());
 
 	load_retro_sym(retro_init);
@@ -371,74 +1113,133 @@ static void core_load(const char *sofile) {
 	load_retro_sym(retro_set_controller_port_device);
 	load_retro_sym(retro_reset);
 	load_retro_sym(retro_run);
+	load_retro_sym(retro_serialize_size);
+	load_retro_sym(retro_serialize);
+	load_retro_sym(retro_unserialize);
+	load_retro_sym(retro_cheat_reset);
+	load_retro_sym(retro_cheat_set);
 	load_retro_sym(retro_load_game);
 	load_retro_sym(retro_unload_game);
+	load_retro_sym(retro_get_memory_data);
+	load_retro_sym(retro_get_memory_size);
+
+	load_retro_sym(retro_set_environment);
+	load_retro_sym(retro_set_video_refresh);
+	load_retro_sym(retro_set_input_poll);
+	load_retro_sym(retro_set_input_state);
+	load_retro_sym(retro_set_audio_sample);
+	load_retro_sym(retro_set_audio_sample_batch);
+}
 
-	load_sym(set_environment, retro_set_environment);
-	load_sym(set_video_refresh, retro_set_video_refresh);
-	load_sym(set_input_poll, retro_set_input_poll);
-	load_sym(set_input_state, retro_set_input_state);
-	load_sym(set_audio_sample, retro_set_audio_sample);
-	load_sym(set_audio_sample_batch, retro_set_audio_sample_batch);
-
-	set_environment(core_environment);
-	set_video_refresh(core_video_refresh);
-	set_input_poll(core_input_poll);
-	set_input_state(core_input_state);
-	set_audio_sample(core_audio_sample);
-	set_audio_sample_batch(core_audio_sample_batch);
+// Hands the core its callbacks and initializes it. Cores make environment
+// calls from retro_set_environment already, so this runs on the main thread.
+static void core_init(struct frontend *fe) {
+	fe->callbacks = g_bench && fe == g_main ? &g_bench_callbacks : &g_callbacks[fe - g_frontends];
+	fe->retro.retro_set_environment(fe->callbacks->environment);
+	fe->retro.retro_set_video_refresh(fe->callbacks->video_refresh);
+	fe->retro.retro_set_input_poll(fe->callbacks->input_poll);
+	fe->retro.retro_set_input_state(fe->callbacks->input_state);
+	fe->retro.retro_set_audio_sample(fe->callbacks->audio_sample);
+	fe->retro.retro_set_audio_sample_batch(fe->callbacks->audio_sample_batch);
 
-	g_retro.retro_init();
-	g_retro.initialized = true;
+	fe->retro.retro_init();
+	fe->retro.initialized = true;
 
 	puts("Core loaded");
 }
 
+static void core_load(struct frontend *fe, const char *sofile) {
+	core_open(fe, sofile);
+	core_init(fe);
+}
 
-static void core_load_game(const char *filename) {
-	struct retro_system_av_info av = {0};
-	struct retro_system_info system = {0};
-	struct retro_game_info info = { filename, 0 };
 
+// Content is read into memory unless the core asks for the path only.
+struct content {
+	struct retro_game_info info;
+	struct retro_system_info system;
+};
+
+static void content_read(struct frontend *fe, const char *filename, struct content *content) {
+	struct retro_game_info *info = &content->info;
     SDL_RWops *file = SDL_RWFromFile(filename, "rb");
 
     if (!file)
         die("Failed to load %s: %s", filename, SDL_GetError());
 
-    info.path = filename;
-    info.meta = "";
-    info.data = NULL;
-    info.size = SDL_RWsize(file);
+    info->path = filename;
+    info->meta = "";
+    info->data = NULL;
+    info->size = SDL_RWsize(file);
 
-	g_retro.retro_get_system_info(&system);
+	fe->retro.retro_get_system_info(&content->system);
 
-	if (!system.need_fullpath) {
-        info.data = SDL_malloc(info.size);
+	if (!content->system.need_fullpath) {
+        info->data = SDL_malloc(info->size);
 
-        if (!info.data)
+        if (!info->data)
             die("Failed to allocate memory for the content");
 
-        if (!SDL_RWread(file, (void*)info.data, info.size, 1))
+        if (!SDL_RWread(file, (void*)info->data, info->size, 1))
             die("Failed to read file data: %s", SDL_GetError());
 	}
 
-	if (!g_retro.retro_load_game(&info))
+    SDL_RWclose(file);
+}
+
+// Opening the core and reading the content only need the file system, the
+// loader thread does both while the main thread brings up SDL. The core gets
+// its callbacks in core_init, after the loader is joined.
+struct loader {
+	struct frontend *fe;
+	const char *core, *content;
+	struct content result;
+};
+
+static int loader_run(void *data) {
+	struct loader *loader = data;
+	Uint64 t0 = SDL_GetPerformanceCounter();
+
+	core_open(loader->fe, loader->core);
+	startup_add(STARTUP_CORE_OPEN, t0);
+
+	t0 = SDL_GetPerformanceCounter();
+	content_read(loader->fe, loader->content, &loader->result);
+	startup_add(STARTUP_CONTENT, t0);
+	return 0;
+}
+
+static void core_load_game(struct frontend *fe, const struct content *content) {
+	struct retro_system_av_info av = {0};
+	const struct retro_system_info *system = &content->system;
+	SDL_Thread *audio_opener = NULL;
+	Uint64 t0 = SDL_GetPerformanceCounter();
+
+	if (!fe->retro.retro_load_game(&content->info))
 		die("The core failed to load the content.");
 
-	g_retro.retro_get_system_av_info(&av);
+	fe->retro.retro_get_system_av_info(&av);
+	fe->av = av;
+	startup_add(STARTUP_LOAD_GAME, t0);
 
-	video_configure(&av.geometry);
-	audio_init(av.timing.sample_rate);
+	if (!fe->headless)
+		audio_opener = audio_open_async(fe);
 
-    if (info.data)
-        SDL_free((void*)info.data);
+	t0 = SDL_GetPerformanceCounter();
+	video_configure(fe, &av.geometry);
+	startup_add(STARTUP_VIDEO, t0);
 
-    SDL_RWclose(file);
+	if (!fe->headless)
+		audio_init(fe, av.timing.sample_rate, audio_opener);
+
+    if (content->info.data)
+        SDL_free((void*)content->info.data);
 
     // Now that we have the system info, set the window title.
     char window_title[255];
-    snprintf(window_title, sizeof(window_title), "sdlarch %s %s", system.library_name, system.library_version);
-    SDL_SetWindowTitle(g_win, window_title);
+    snprintf(window_title, sizeof(window_title), "sdlarch %s %s", system->library_name, system->library_version);
+    if (fe->win)
+        SDL_SetWindowTitle(fe->win, window_title);
 }
 
 /**
@@ -452,76 +1253,814 @@ retro_time_t cpu_features_get_time_usec(void) {
     return (retro_time_t)SDL_GetTicks();
 }
 
-static void core_unload() {
-	if (g_retro.initialized)
-		g_retro.retro_deinit();
+// Save RAM lives next to the content, with its extension replaced by .srm.
+// Hashed runs leave it alone so movies and golden files stay reproducible
+// and never overwrite a real save.
+static void core_load_sram(struct frontend *fe, const char *content) {
+    void *data = fe->retro.retro_get_memory_data(RETRO_MEMORY_SAVE_RAM);
+    size_t size = fe->retro.retro_get_memory_size(RETRO_MEMORY_SAVE_RAM);
+    const char *dot = strrchr(content, '.'), *slash = strrchr(content, '/');
+    int len = dot && (!slash || dot > slash) ? (int)(dot - content) : (int)strlen(content);
+    char path[1024];
+
+    if (!data || !size || g_hash_frames)
+        return;
+
+    snprintf(path, sizeof(path), "%.*s.srm", len, content);
+    if (!sram_open(path, data, size))
+        die("Failed to set up save RAM in %s", path);
+}
+
+// Cores without SET_MEMORY_MAPS get their system RAM mapped at address 0.
+static void core_load_memmap(struct frontend *fe) {
+    if (!memmap_active())
+        memmap_set_ram(fe->retro.retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM),
+                       fe->retro.retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM));
+}
+
+static void watch_begin() {
+    unsigned i;
+
+    for (i = 0; i < g_num_watch_args; ++i)
+        if (memmap_watch(g_watch_args[i].addr, g_watch_args[i].len) < 0)
+            die("Cannot watch $%zx:%zu, it is not mapped to contiguous memory",
+                g_watch_args[i].addr, g_watch_args[i].len);
+}
+
+// Code cheats go to the core, RAM cheats are compiled against the memory map
+// and written after every frame.
+static void core_load_cheats(struct frontend *fe, const char *path) {
+    unsigned i;
+
+    if (!cheats_load(path))
+        die("Failed to load cheats from %s", path);
+
+    fe->retro.retro_cheat_reset();
+    for (i = 0; i < cheats_code_count(); ++i)
+        fe->retro.retro_cheat_set(i, true, cheats_code(i));
+
+    if (!cheats_compile())
+        die("Failed to apply the RAM cheats of %s", path);
+    cheats_apply();
+}
+
+static void search_begin(struct frontend *fe) {
+    if (!g_num_search_steps)
+        return;
+
+    if (!ramsearch_begin(fe->retro.retro_get_memory_data(RETRO_MEMORY_SYSTEM_RAM),
+                         fe->retro.retro_get_memory_size(RETRO_MEMORY_SYSTEM_RAM)))
+        die("The core has no system RAM to search");
+}
+
+static void search_frame(uint64_t frame) {
+    size_t offsets[16], n, i;
+    uint8_t values[16];
+
+    while (g_search_next < g_num_search_steps && g_search_steps[g_search_next].frame == frame) {
+        n = ramsearch_filter(g_search_steps[g_search_next].filter, g_search_steps[g_search_next].value);
+        printf("search: frame %llu %s: %zu candidates\r\n", (unsigned long long)frame,
+            g_search_steps[g_search_next].name, n);
+
+        if (++g_search_next < g_num_search_steps)
+            continue;
+
+        n = ramsearch_results(offsets, values, 16);
+        for (i = 0; i < n; ++i)
+            printf("search:   $%04zx = %u\r\n", offsets[i], values[i]);
+    }
+}
+
+static void watch_changed(unsigned id, size_t addr, size_t len, const uint8_t *old, const uint8_t *now) {
+    size_t i, n = 0;
+
+    (void)id;
+
+    if (len > 8) {
+        for (i = 0; i < len; ++i)
+            n += old[i] != now[i];
+        printf("watch: frame %llu $%06zx: %zu of %zu bytes changed\r\n", (unsigned long long)g_frame, addr, n, len);
+        return;
+    }
+
+    printf("watch: frame %llu $%06zx:", (unsigned long long)g_frame, addr);
+    for (i = 0; i < len; ++i)
+        printf(" %02x", old[i]);
+    printf(" ->");
+    for (i = 0; i < len; ++i)
+        printf(" %02x", now[i]);
+    printf("\r\n");
+}
+
+static void core_unload(struct frontend *fe) {
+	if (fe->retro.initialized)
+		fe->retro.retro_deinit();
+
+	if (fe->retro.handle)
+        SDL_UnloadObject(fe->retro.handle);
+}
+
+static uint16_t input_mask(struct frontend *fe) {
+    uint16_t mask = 0;
+    unsigned i;
+
+    for (i = 0; i <= RETRO_DEVICE_ID_JOYPAD_R3; ++i)
+        if (fe->joy[0][i])
+            mask |= 1 << i;
+
+    return mask;
+}
+
+// Puts a core at the movie's starting point, the savestate or a reset.
+static void movie_anchor_core(struct frontend *fe, enum movie_anchor anchor, const void *state, size_t size) {
+    if (anchor == MOVIE_ANCHOR_STATE) {
+        if (!fe->retro.retro_unserialize(state, size))
+            die("The core failed to restore the movie savestate.");
+    } else {
+        fe->retro.retro_reset();
+    }
+}
+
+// A --compare core starts from the same point as the main one.
+static void movie_begin(struct frontend *fe, struct frontend *other, const char *path, bool record,
+    enum movie_anchor anchor) {
+    size_t size = 0;
+    void *state = NULL;
+
+    if (!record) {
+        const void *data;
+
+        if (!movie_playback_begin(path))
+            die("Failed to load movie %s", path);
+
+        data = movie_get_state(&size);
+        movie_anchor_core(fe, movie_get_anchor(), data, size);
+        if (other)
+            movie_anchor_core(other, movie_get_anchor(), data, size);
+
+        g_unthrottled = true;
+        g_hash_frames = true;
+        return;
+    }
+
+    if (anchor == MOVIE_ANCHOR_STATE) {
+        size = fe->retro.retro_serialize_size();
+        state = SDL_malloc(size ? size : 1);
+
+        if (!state || !size || !fe->retro.retro_serialize(state, size))
+            die("The core failed to create a savestate for the movie.");
+    } else {
+        fe->retro.retro_reset();
+    }
+    if (other)
+        movie_anchor_core(other, anchor, state, size);
+
+    if (!movie_record_begin(path, anchor, state, size))
+        die("Failed to start recording %s", path);
+
+    SDL_free(state);
+    g_hash_frames = true;
+}
+
+static int movie_end() {
+    struct movie_stats stats;
+    enum movie_mode mode = movie_get_mode();
+
+    if (mode == MOVIE_OFF)
+        return EXIT_SUCCESS;
+
+    if (!movie_finish(&stats))
+        return EXIT_FAILURE;
+
+    if (mode == MOVIE_RECORD) {
+        printf("movie: recorded %u frames\r\n", stats.frames);
+        return EXIT_SUCCESS;
+    }
+
+    if (stats.mismatches) {
+        printf("movie: %u of %u frames mismatched, first at frame %lld\r\n",
+            stats.mismatches, stats.frames, (long long)stats.first_mismatch);
+        return EXIT_FAILURE;
+    }
+
+    printf("movie: %u frames replayed, all hashes match\r\n", stats.frames);
+    return EXIT_SUCCESS;
+}
+
+// Advances a context by one frame: the frame time and audio callbacks, then
+// retro_run and the audio it staged.
+static void run_frame(struct frontend *fe) {
+    // Update the game loop timer.
+    if (fe->frame_time.callback) {
+        retro_time_t current = cpu_features_get_time_usec();
+        retro_time_t delta = current - fe->frame_time_last;
+
+        // Netplay sides have to run the same frames, whatever their clocks.
+        if (!fe->frame_time_last || g_netplay)
+            delta = fe->frame_time.reference;
+        fe->frame_time_last = current;
+        fe->frame_time.callback(delta * 1000);
+    }
+
+    // Without the audio thread, ask the core to emit the audio once per
+    // frame.
+    if (fe->audio_callback.callback && !fe->audio_thread) {
+        fe->audio_callback.callback();
+    }
+
+    if ((g_bench || g_telemetry) && fe == g_main) {
+        Uint64 t0 = SDL_GetPerformanceCounter(), t1;
+        g_telemetry_video = 0;
+        fe->retro.retro_run();
+        t1 = SDL_GetPerformanceCounter();
+        audio_flush(fe);
+        if (g_bench) {
+            g_bench_ticks.audio += SDL_GetPerformanceCounter() - t1;
+            g_bench_ticks.run += SDL_GetPerformanceCounter() - t0;
+        }
+        if (g_telemetry)
+            telemetry_record(TELEMETRY_RUN, ticks_usec(t1 - t0 - g_telemetry_video));
+    } else {
+        fe->retro.retro_run();
+        audio_flush(fe);
+    }
+}
+
+// Netplay hands over both pads of every frame it runs, including the ones
+// it runs again after a rollback.
+static void netplay_run(const uint16_t input[NETPLAY_PLAYERS], bool replay) {
+    unsigned port, i;
+
+    for (port = 0; port < NETPLAY_PLAYERS; ++port)
+        for (i = 0; i <= RETRO_DEVICE_ID_JOYPAD_R3; ++i)
+            g_main->joy[port][i] = (input[port] >> i) & 1;
 
-	if (g_retro.handle)
-        SDL_UnloadObject(g_retro.handle);
+    g_main->replaying = replay;
+    run_frame(g_main);
+    cheats_apply();
+    g_main->replaying = false;
+}
+
+static void netplay_begin(struct frontend *fe, const struct netplay_config *config) {
+    struct netplay_core core = {
+        fe->retro.retro_serialize_size(),
+        fe->retro.retro_serialize, fe->retro.retro_unserialize,
+        netplay_run,
+    };
+
+    if (!core.state_size)
+        die("Netplay needs a core that supports savestates");
+
+    fe->retro.retro_set_controller_port_device(1, RETRO_DEVICE_JOYPAD);
+    if (!netplay_open(config, &core))
+        die("Failed to start netplay on port %u", config->local_port);
+    g_netplay = true;
+}
+
+// Both sides print the hash of their final state, which has to match.
+static int netplay_end(struct frontend *fe) {
+    struct netplay_stats stats;
+    size_t size = fe->retro.retro_serialize_size();
+    void *state = malloc(size);
+    int status = EXIT_SUCCESS;
+
+    if (!netplay_finish()) {
+        status = EXIT_FAILURE;
+    } else if (state && fe->retro.retro_serialize(state, size)) {
+        printf("netplay: final state %016llx\r\n", (unsigned long long)hash64(state, size, HASH_SEED));
+    }
+    free(state);
+
+    netplay_get_stats(&stats);
+    printf("netplay: %llu frames, %llu rollbacks of up to %u frames, %llu frames resimulated in %.3f ms "
+           "(slowest rollback %.3f ms), %llu waits\r\n",
+        (unsigned long long)stats.frames, (unsigned long long)stats.rollbacks, stats.max_depth,
+        (unsigned long long)stats.resim_frames, stats.resim_ms, stats.max_resim_ms,
+        (unsigned long long)stats.waits);
+
+    netplay_close();
+    return status;
 }
 
 static void noop() {}
 
 int main(int argc, char *argv[]) {
-	if (argc < 3)
-		die("usage: %s <core> <game>", argv[0]);
+    const char *core = NULL, *game = NULL, *movie = NULL, *golden = NULL, *capture = NULL;
+    const char *screenshot_dir = ".", *cheats = NULL, *compare = NULL;
+    struct frontend *fe = g_main, *other = &g_frontends[1];
+    const char **contents = SDL_calloc(argc, sizeof(*contents));
+    unsigned long long frame_arg;
+    unsigned batch = 0, batch_threads = 0, num_contents = 0;
+    enum recorder_format capture_format = RECORDER_Y4M;
+    enum movie_anchor anchor = MOVIE_ANCHOR_RESET;
+    bool record = false, golden_write = false;
+    Uint64 start, setup, frames = 0, max_frames = 0, compare_first = 0;
+    unsigned compare_mismatches = 0;
+    struct loader loader = { 0 };
+    struct content compare_content = { 0 };
+    struct netplay_config netplay = { 0, NULL, 0, 0, 2, 8 };
+    struct telemetry_config telemetry = { NULL, TELEMETRY_PROMETHEUS, 1000 };
+    bool telemetry_format = false;
+    int gpu_sync = VIDEO_GPU_SYNC_OFF, frame_delay = 0;
+    Uint64 frame_start;
+    char netplay_host[256];
+    SDL_Thread *loader_thread;
+    int i, status;
+
+    g_startup.start = SDL_GetPerformanceCounter();
+
+    for (i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--record") && i + 1 < argc) {
+            movie = argv[++i];
+            record = true;
+        } else if (!strcmp(argv[i], "--record-state") && i + 1 < argc) {
+            movie = argv[++i];
+            record = true;
+            anchor = MOVIE_ANCHOR_STATE;
+        } else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+            capture = argv[++i];
+        } else if (!strcmp(argv[i], "--capture-format") && i + 1 < argc) {
+            if (!recorder_parse_format(argv[++i], &capture_format))
+                die("Unknown capture format %s, expected y4m or rgb", argv[i]);
+        } else if (!strcmp(argv[i], "--screenshot-dir") && i + 1 < argc) {
+            screenshot_dir = argv[++i];
+        } else if (!strcmp(argv[i], "--screenshot-every") && i + 1 < argc) {
+            g_screenshot_every = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--watch") && i + 1 < argc) {
+            char *end;
+
+            if (g_num_watch_args == WATCH_MAX)
+                die("At most %d --watch options are supported", WATCH_MAX);
+            g_watch_args[g_num_watch_args].addr = strtoull(argv[++i], &end, 16);
+            g_watch_args[g_num_watch_args].len = *end == ':' ? strtoull(end + 1, &end, 10) : 1;
+            if (*end || !g_watch_args[g_num_watch_args].len)
+                die("Bad watch %s, expected <hex address>[:<bytes>]", argv[i]);
+            g_num_watch_args++;
+        } else if (!strcmp(argv[i], "--cheats") && i + 1 < argc) {
+            cheats = argv[++i];
+        } else if (!strcmp(argv[i], "--search") && i + 1 < argc) {
+            char name[16];
+            const char *filter, *value;
+
+            if (g_num_search_steps == SEARCH_MAX)
+                die("At most %d --search options are supported", SEARCH_MAX);
+            if (sscanf(argv[++i], "%llu:%15[a-z]", &frame_arg, name) != 2 || !frame_arg ||
+                !ramsearch_parse_filter(name, &g_search_steps[g_num_search_steps].filter) ||
+                (g_num_search_steps && frame_arg < g_search_steps[g_num_search_steps - 1].frame))
+                die("Bad search %s, expected <frame>:<eq|gt|changed|unchanged>[:<value>] in frame order", argv[i]);
+            filter = strchr(argv[i], ':') + 1;
+            value = strchr(filter, ':');
+            g_search_steps[g_num_search_steps].frame = frame_arg;
+            g_search_steps[g_num_search_steps].name = filter;
+            g_search_steps[g_num_search_steps].value = value ? strtoul(value + 1, NULL, 0) : 0;
+            g_num_search_steps++;
+        } else if (!strcmp(argv[i], "--play") && i + 1 < argc) {
+            movie = argv[++i];
+            record = false;
+            g_unthrottled = true;
+        } else if (!strcmp(argv[i], "--headless")) {
+            g_headless = true;
+            g_unthrottled = true;
+        } else if (!strcmp(argv[i], "--bench")) {
+            g_bench = true;
+            g_unthrottled = true;
+        } else if (!strcmp(argv[i], "--startup-profile")) {
+            g_startup_profile = true;
+        } else if (!strcmp(argv[i], "--bench-resampler")) {
+            bench_resampler();
+            return EXIT_SUCCESS;
+        } else if (!strcmp(argv[i], "--resampler") && i + 1 < argc) {
+            if (!resampler_parse_quality(argv[++i], &g_resampler_quality))
+                die("Unknown resampler %s, expected cubic, sinc or sinc-hq", argv[i]);
+        } else if (!strcmp(argv[i], "--shader") && i + 1 < argc) {
+            if (!video_shader_add(argv[++i]))
+                die("Failed to load shader preset %s", argv[i]);
+        } else if (!strcmp(argv[i], "--viewport") && i + 1 < argc) {
+            if (!viewport_parse_mode(argv[++i], &g_viewport_mode))
+                die("Unknown viewport mode %s, expected aspect, integer or stretch", argv[i]);
+        } else if (!strcmp(argv[i], "--gl-check-interval") && i + 1 < argc) {
+            g_gl_check_interval = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            max_frames = strtoull(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--golden") && i + 1 < argc) {
+            golden = argv[++i];
+            golden_write = false;
+        } else if (!strcmp(argv[i], "--golden-write") && i + 1 < argc) {
+            golden = argv[++i];
+            golden_write = true;
+        } else if (!strcmp(argv[i], "--compare") && i + 1 < argc) {
+            compare = argv[++i];
+        } else if (!strcmp(argv[i], "--netplay") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%hu:%255[^:]:%hu", &netplay.local_port, netplay_host, &netplay.remote_port) != 3)
+                die("Bad netplay address %s, expected <local port>:<host>:<remote port>", argv[i]);
+            netplay.remote_host = netplay_host;
+        } else if (!strcmp(argv[i], "--netplay-player") && i + 1 < argc) {
+            netplay.player = strtoul(argv[++i], NULL, 10) - 1;
+            if (netplay.player >= NETPLAY_PLAYERS)
+                die("Bad netplay player %s, expected 1 or 2", argv[i]);
+        } else if (!strcmp(argv[i], "--netplay-delay") && i + 1 < argc) {
+            netplay.delay = strtoul(argv[++i], NULL, 10);
+            if (netplay.delay > NETPLAY_MAX_DELAY)
+                die("Netplay delay %s is above %d frames", argv[i], NETPLAY_MAX_DELAY);
+        } else if (!strcmp(argv[i], "--netplay-window") && i + 1 < argc) {
+            netplay.window = strtoul(argv[++i], NULL, 10);
+            if (netplay.window > NETPLAY_MAX_WINDOW)
+                die("Netplay window %s is above %d frames", argv[i], NETPLAY_MAX_WINDOW);
+        } else if (!strcmp(argv[i], "--swap") && i + 1 < argc) {
+            if (!pacing_parse_swap(argv[++i], &g_swap_policy))
+                die("Unknown swap policy %s, expected vsync, off or adaptive", argv[i]);
+        } else if (!strcmp(argv[i], "--frame-delay") && i + 1 < argc) {
+            char *end;
+
+            // Only "auto" maps to the negative automatic delay.
+            if (strcmp(argv[++i], "auto")) {
+                frame_delay = (int)strtol(argv[i], &end, 10);
+                if (end == argv[i] || *end || frame_delay < 0 || frame_delay >= 1000)
+                    die("Bad frame delay %s, expected milliseconds or auto", argv[i]);
+            } else {
+                frame_delay = -1;
+            }
+            g_frame_delay = true;
+        } else if (!strcmp(argv[i], "--gpu-sync") && i + 1 < argc) {
+            char *end;
+
+            gpu_sync = strcmp(argv[++i], "measure") ? strtol(argv[i], &end, 10) : VIDEO_GPU_SYNC_MEASURE;
+            if (gpu_sync != VIDEO_GPU_SYNC_MEASURE && (*end || gpu_sync < 0 || gpu_sync > VIDEO_GPU_SYNC_MAX))
+                die("Bad GPU sync %s, expected 0 to %d frames or measure", argv[i], VIDEO_GPU_SYNC_MAX);
+        } else if (!strcmp(argv[i], "--telemetry") && i + 1 < argc) {
+            telemetry.target = argv[++i];
+        } else if (!strcmp(argv[i], "--telemetry-format") && i + 1 < argc) {
+            if (!telemetry_parse_format(argv[++i], &telemetry.format))
+                die("Unknown telemetry format %s, expected prometheus or json", argv[i]);
+            telemetry_format = true;
+        } else if (!strcmp(argv[i], "--telemetry-interval") && i + 1 < argc) {
+            telemetry.interval_ms = strtoul(argv[++i], NULL, 10);
+            if (!telemetry.interval_ms)
+                die("The telemetry interval has to be at least 1 ms");
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            batch = strtoul(argv[++i], NULL, 10);
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            batch_threads = strtoul(argv[++i], NULL, 10);
+        } else if (!core) {
+            core = argv[i];
+        } else {
+            contents[num_contents++] = argv[i];
+        }
+    }
+    game = num_contents ? contents[0] : NULL;
+
+	if (!core || !game)
+		die("usage: %s [options] <core> <game> [<game> ...]\n"
+		    "  --headless               run without window, GL or audio\n"
+		    "  --bench                  run unthrottled and report frontend overhead\n"
+		    "  --bench-resampler        benchmark the audio resampler and exit\n"
+		    "  --startup-profile        print where the time to the first frame went\n"
+		    "  --resampler <quality>    cubic, sinc (default) or sinc-hq\n"
+		    "  --frames <n>             stop after n frames\n"
+		    "  --shader <preset>        add a shader preset or built-in shader, F2 cycles\n"
+		    "  --viewport <mode>        aspect (default), integer or stretch\n"
+		    "  --gl-check-interval <n>  check GL errors every n frames (DEBUG=1 builds)\n"
+		    "  --golden <file>          compare frame hashes against a golden file\n"
+		    "  --golden-write <file>    write frame hashes to a golden file\n"
+		    "  --record <movie>         record input from a power-on reset\n"
+		    "  --record-state <movie>   record input from a savestate\n"
+		    "  --capture <base>         write video and audio to <base>.y4m and <base>.wav\n"
+		    "  --capture-format <fmt>   y4m (default) or rgb, raw frames in <base>.rgb\n"
+		    "  --screenshot-dir <dir>   where F12 and --screenshot-every save PNGs\n"
+		    "  --screenshot-every <n>   save a screenshot every n frames\n"
+		    "  --watch <addr>[:<n>]     print changes to n bytes (default 1) at a hex address\n"
+		    "  --cheats <file>          apply the enabled cheats of a .cht file\n"
+		    "  --search <frame>:<filter>[:<value>]\n"
+		    "                           filter system RAM with eq, gt, changed or unchanged\n"
+		    "  --play <movie>           replay a movie and verify its hashes\n"
+		    "  --compare <core>         run a second core headless in lockstep and compare\n"
+		    "                           its frame hashes\n"
+		    "  --netplay <port>:<host>:<port>\n"
+		    "                           rollback netplay over UDP, local port first\n"
+		    "  --netplay-player <n>     the pad driven here, 1 (default) or 2\n"
+		    "  --netplay-delay <n>      frames of input delay (default 2)\n"
+		    "  --netplay-window <n>     frames to run ahead of the remote (default 8)\n"
+		    "  --swap <policy>          vsync (default), off or adaptive\n"
+		    "  --frame-delay <ms>       sleep after the vblank before running the core,\n"
+		    "                           auto tunes it to the core's run time\n"
+		    "  --gpu-sync <n>           let the GPU fall at most n frames (0-3) behind, or\n"
+		    "                           measure to only report the latency\n"
+		    "  --telemetry <target>     snapshot frame statistics to a file or unix:<socket>\n"
+		    "  --telemetry-format <fmt> prometheus or json, default from a .json target\n"
+		    "  --telemetry-interval <n> milliseconds between snapshots (default 1000)\n"
+		    "  --batch <n>              run n headless instances, cycling through the games\n"
+		    "  --threads <n>            worker threads for --batch (default: one per CPU)", argv[0]);
+
+    if (netplay.remote_host && (movie || golden || compare || batch))
+        die("--netplay cannot be combined with movies, golden files, --compare or --batch");
+
+    if (batch) {
+        struct batch_config config = {
+            core, contents, num_contents, batch, batch_threads,
+            max_frames ? max_frames : 600,
+        };
+
+        return batch_run(&config) ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    if (SDL_Init(SDL_INIT_EVERYTHING) < 0)
+    for (i = 0; i < FRONTEND_MAX; ++i) {
+        g_frontends[i].headless = g_headless || i;
+        g_frontends[i].running = true;
+        g_frontends[i].pixel_format = RETRO_PIXEL_FORMAT_0RGB1555;
+        g_frontends[i].video_hash = HASH_SEED;
+        g_frontends[i].audio_hash = HASH_SEED;
+        g_frontends[i].video.hw.version_major = 4;
+        g_frontends[i].video.hw.version_minor = 5;
+        g_frontends[i].video.hw.context_type  = RETRO_HW_CONTEXT_OPENGLES2;
+        g_frontends[i].video.hw.context_reset   = noop;
+        g_frontends[i].video.hw.context_destroy = noop;
+    }
+
+    // Open the core and read the game while SDL comes up.
+    loader.fe = fe;
+    loader.core = core;
+    loader.content = game;
+    loader_thread = SDL_CreateThread(loader_run, "loader", &loader);
+    if (!loader_thread)
+        loader_run(&loader);
+
+    // Audio is brought up on its own once the sample rate is known.
+    start = SDL_GetPerformanceCounter();
+    if (SDL_Init(g_headless ? SDL_INIT_EVENTS : SDL_INIT_VIDEO) < 0)
         die("Failed to initialize SDL");
+    startup_add(STARTUP_SDL, start);
+
+    if (!screenshot_init(screenshot_dir, g_unthrottled && !g_bench))
+        die("Failed to start the screenshot worker");
 
-    g_video.hw.version_major = 4;
-    g_video.hw.version_minor = 5;
-    g_video.hw.context_type  = RETRO_HW_CONTEXT_OPENGLES2;
-    g_video.hw.context_reset   = noop;
-    g_video.hw.context_destroy = noop;
+    if (golden) {
+        if (!golden_open(golden, golden_write))
+            die("Failed to open golden file %s", golden);
+        g_hash_frames = true;
+    }
 
-    // Load the core.
-    core_load(argv[1]);
+    start = SDL_GetPerformanceCounter();
+    if (loader_thread)
+        SDL_WaitThread(loader_thread, NULL);
+    startup_add(STARTUP_LOADER_WAIT, start);
+
+    start = SDL_GetPerformanceCounter();
+    core_init(fe);
+    startup_add(STARTUP_CORE_INIT, start);
 
     // Load the game.
-    core_load_game(argv[2]);
+    core_load_game(fe, &loader.result);
 
     // Configure the player input devices.
-    g_retro.retro_set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
+    fe->retro.retro_set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
+
+    // The second core starts from the same point and gets the same input.
+    if (compare) {
+        core_load(other, compare);
+        if (other->retro.handle == fe->retro.handle)
+            die("--compare needs a core in a different file, cores keep their state in globals");
+        content_read(other, game, &compare_content);
+        core_load_game(other, &compare_content);
+        other->retro.retro_set_controller_port_device(0, RETRO_DEVICE_JOYPAD);
+        g_hash_frames = true;
+    }
 
-    SDL_Event ev;
+    setup = SDL_GetPerformanceCounter();
 
-    while (running) {
-        // Update the game loop timer.
-        if (runloop_frame_time.callback) {
-            retro_time_t current = cpu_features_get_time_usec();
-            retro_time_t delta = current - runloop_frame_time_last;
+    // Anchor the movie once the content is running.
+    if (movie)
+        movie_begin(fe, compare ? other : NULL, movie, record, anchor);
 
-            if (!runloop_frame_time_last)
-                delta = runloop_frame_time.reference;
-            runloop_frame_time_last = current;
-            runloop_frame_time.callback(delta * 1000);
-        }
+    if (capture) {
+        struct recorder_config config = {
+            capture_format, fe->pixel_format,
+            fe->av.geometry.max_width, fe->av.geometry.max_height, fe->av.geometry.aspect_ratio,
+            fe->av.timing.fps, fe->av.timing.sample_rate, g_resampler_quality,
+            // Only real-time runs have to drop frames to keep up.
+            g_unthrottled && !g_bench,
+        };
 
-        // Ask the core to emit the audio.
-        if (audio_callback.callback) {
-            audio_callback.callback();
-        }
+        if (!recorder_open(capture, &config))
+            die("Failed to start capturing to %s", capture);
+    }
 
+    core_load_sram(fe, game);
+    core_load_memmap(fe);
+    if (cheats)
+        core_load_cheats(fe, cheats);
+    watch_begin();
+    search_begin(fe);
+    if (netplay.remote_host)
+        netplay_begin(fe, &netplay);
+
+    if (gpu_sync != VIDEO_GPU_SYNC_OFF) {
+        if (fe->headless)
+            die("--gpu-sync needs a window");
+        if (!video_set_gpu_sync(gpu_sync))
+            die("GPU sync needs fences, from GLES 3.0 or GL 3.2");
+    }
+
+    if (g_frame_delay) {
+        if (fe->headless || g_unthrottled || g_swap_policy == SWAP_OFF)
+            die("--frame-delay needs a window with vsync");
+        // A delay as long as the frame would make every frame late.
+        if (frame_delay >= 0 && fe->av.timing.fps > 0 && frame_delay >= 1000.0 / fe->av.timing.fps)
+            die("--frame-delay %d ms does not fit in a %.1f ms frame", frame_delay, 1000.0 / fe->av.timing.fps);
+        pacing_init(fe->av.timing.fps, frame_delay);
+    }
+
+    if (telemetry.target) {
+        size_t len = strlen(telemetry.target);
+
+        if (!telemetry_format && len > 5 && !strcmp(telemetry.target + len - 5, ".json"))
+            telemetry.format = TELEMETRY_JSON;
+        if (!telemetry_open(&telemetry))
+            die("Failed to start telemetry to %s", telemetry.target);
+        g_telemetry = true;
+    }
+
+    SDL_Event ev;
+    audio_thread_start(fe);
+    startup_add(STARTUP_SETUP, setup);
+    start = SDL_GetPerformanceCounter();
+
+    while (fe->running) {
         while (SDL_PollEvent(&ev)) {
             switch (ev.type) {
-            case SDL_QUIT: running = false; break;
+            case SDL_QUIT: fe->running = false; break;
             case SDL_WINDOWEVENT:
                 switch (ev.window.event) {
-                case SDL_WINDOWEVENT_CLOSE: running = false; break;
+                case SDL_WINDOWEVENT_CLOSE: fe->running = false; break;
+                case SDL_WINDOWEVENT_SIZE_CHANGED: video_window_resized(); break;
                 }
+                break;
+            case SDL_KEYDOWN:
+                if (ev.key.keysym.scancode == SDL_SCANCODE_F2 && !ev.key.repeat)
+                    video_shader_next();
+                else if (ev.key.keysym.scancode == SDL_SCANCODE_F12 && !ev.key.repeat)
+                    g_screenshot_pending = true;
+                else if (ev.key.keysym.scancode == SDL_SCANCODE_PAUSE && !ev.key.repeat)
+                    audio_set_paused(fe, !fe->paused);
+                break;
             }
         }
 
+        if (fe->paused) {
+            // Resume with a nominal frame time rather than the pause length.
+            fe->frame_time_last = 0;
+            SDL_Delay(10);
+            continue;
+        }
+
         //glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		g_retro.retro_run();
+        video_gpu_sync();
+        if (g_frame_delay && pacing_delay())
+            SDL_Delay(pacing_delay());
+        frame_start = SDL_GetPerformanceCounter();
+
+        if (g_netplay) {
+            int ran;
+
+            input_read(fe);
+            ran = netplay_frame(input_mask(fe));
+            if (ran < 0)
+                break;
+            if (!ran)
+                continue;
+        } else {
+            run_frame(fe);
+            cheats_apply();
+        }
+        sram_frame();
+		frames++;
+
+        if (g_frame_delay && g_swap_start > frame_start)
+            pacing_frame(ticks_usec(g_swap_start - frame_start) / 1000.0);
+
+        if (g_telemetry) {
+            telemetry_count(TELEMETRY_FRAMES, 1);
+            // Device audio is 16-bit stereo.
+            if (fe->pcm)
+                telemetry_record(TELEMETRY_AUDIO_FILL,
+                    (uint64_t)SDL_GetQueuedAudioSize(fe->pcm) * 1000000 / (AUDIO_DEVICE_RATE * 4));
+        }
+
+        if (frames == 1) {
+            startup_add(STARTUP_FIRST_FRAME, start);
+            if (g_startup_profile)
+                startup_report();
+        }
+
+        if (compare) {
+            run_frame(other);
+            if ((other->video_hash != fe->video_hash || other->audio_hash != fe->audio_hash) &&
+                !compare_mismatches++)
+                compare_first = frames;
+            other->video_hash = HASH_SEED;
+            other->audio_hash = HASH_SEED;
+        }
+
+        g_frame = frames;
+        memmap_check(watch_changed);
+        search_frame(frames);
+
+        if (movie_get_mode() != MOVIE_OFF) {
+            if (!movie_frame_end(input_mask(fe), fe->video_hash, fe->audio_hash))
+                fe->running = false;
+        }
+
+        if (golden)
+            golden_frame(fe->video_hash, fe->audio_hash);
+
+        if (max_frames && frames >= max_frames)
+            fe->running = false;
+
+        fe->video_hash = HASH_SEED;
+        fe->audio_hash = HASH_SEED;
 	}
 
-	core_unload();
-	audio_deinit();
-	video_deinit();
+    if (g_unthrottled) {
+        double secs = (double)(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        printf("%llu frames in %.3f s (%.1f fps)\r\n", (unsigned long long)frames, secs, secs > 0 ? frames / secs : 0);
+    }
+
+    if (g_bench)
+        bench_report(frames);
+
+    telemetry_close();
+
+    if (g_frame_delay) {
+        struct pacing_stats pacing;
+
+        pacing_get_stats(&pacing);
+        printf("frame delay: %.1f ms average (%u to %u ms), %u of %u frames late\r\n",
+            pacing.frames ? pacing.delay_ms / pacing.frames : 0, pacing.min_delay, pacing.max_delay,
+            pacing.late, pacing.frames);
+    }
+
+    if (gpu_sync != VIDEO_GPU_SYNC_OFF) {
+        struct video_sync_stats sync;
+
+        video_gpu_sync_stats(&sync);
+        if (gpu_sync == VIDEO_GPU_SYNC_MEASURE)
+            printf("gpu sync off: ");
+        else
+            printf("gpu sync %d: ", gpu_sync);
+        printf("%u frames, frame start to GPU done %.2f ms average, %.2f ms max, %.2f ms waiting per frame\r\n",
+            sync.frames, sync.frames ? sync.latency_ms / sync.frames : 0, sync.max_latency_ms,
+            frames ? sync.wait_ms / frames : 0);
+    }
+
+    status = movie_end();
+
+    if (g_netplay && netplay_end(fe) != EXIT_SUCCESS)
+        status = EXIT_FAILURE;
+
+    if (compare && compare_mismatches) {
+        printf("compare: %u of %llu frames differ, first at frame %llu\r\n", compare_mismatches,
+            (unsigned long long)frames, (unsigned long long)compare_first);
+        status = EXIT_FAILURE;
+    } else if (compare) {
+        printf("compare: %llu frames match\r\n", (unsigned long long)frames);
+    }
+
+    if (golden) {
+        size_t missing;
+        unsigned mismatches = golden_close(&missing);
+
+        if (mismatches) {
+            printf("golden: %u of %llu frames mismatched\r\n", mismatches, (unsigned long long)frames);
+            status = EXIT_FAILURE;
+        } else {
+            printf("golden: %llu frames match\r\n", (unsigned long long)frames);
+        }
+
+        // A run cut short by --frames checks a prefix of the file, any
+        // other early end is a failure.
+        if (missing && max_frames && frames >= max_frames) {
+            printf("golden: the last %zu frames of the file were not run\r\n", missing);
+        } else if (missing) {
+            printf("golden: %zu frames missing from the run\r\n", missing);
+            status = EXIT_FAILURE;
+        }
+    }
+
+	screenshot_poll(true);
+	screenshot_deinit();
+
+	// The audio thread and set_state still call into the core.
+	audio_deinit(fe);
+	recorder_close();
+	sram_close();
+	core_unload(fe);
+	if (compare)
+		core_unload(other);
+	cheats_deinit();
+	ramsearch_end();
+	memmap_deinit();
+	video_deinit(fe);
 
     SDL_Quit();
 
-    return EXIT_SUCCESS;
+    return status;
 }
@@ -0,0 +1,195 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "gl_loader.h"
+#include "hash.h"
+#include "shader_cache.h"
+
+#define CACHE_MAGIC 0x42504453 // "SDPB"
+#define CACHE_VERSION 1
+
+struct cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+    uint64_t checksum;
+};
+
+static struct {
+    bool enabled;
+    bool hint;
+    char dir[512];
+    uint64_t renderer;
+
+    PFNGLGETPROGRAMBINARYPROC get_binary;
+    PFNGLPROGRAMBINARYPROC program_binary;
+} g_cache;
+
+// The OES entry points differ from the core ones only in the type of the
+// length argument.
+static void APIENTRY program_binary_oes(GLuint program, GLenum format, const void *binary, GLsizei length) {
+    glProgramBinaryOES(program, format, binary, length);
+}
+
+static bool cache_dir(char *dir, size_t size) {
+    const char *base = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    char parent[480];
+
+    if (base && *base)
+        snprintf(parent, sizeof(parent), "%s", base);
+    else if (home && *home)
+        snprintf(parent, sizeof(parent), "%s/.cache", home);
+    else
+        return false;
+
+    mkdir(parent, 0755);
+    snprintf(dir, size, "%s/sdlarch", parent);
+    mkdir(dir, 0755);
+
+    return true;
+}
+
+bool shader_cache_init(void) {
+    const char *renderer = (const char*)glGetString(GL_RENDERER);
+    const char *version = (const char*)glGetString(GL_VERSION);
+    GLint formats = 0;
+
+    memset(&g_cache, 0, sizeof(g_cache));
+
+    if (!gl_loader_require(GL_FEATURE_PROGRAM_BINARY)) {
+        return false;
+    } else if (glGetProgramBinary && glProgramBinary) {
+        g_cache.get_binary = glGetProgramBinary;
+        g_cache.program_binary = glProgramBinary;
+        g_cache.hint = glProgramParameteri != NULL;
+    } else if (GLAD_GL_OES_get_program_binary) {
+        g_cache.get_binary = glGetProgramBinaryOES;
+        g_cache.program_binary = program_binary_oes;
+    } else {
+        return false;
+    }
+
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    if (formats <= 0 || !renderer || !version || !cache_dir(g_cache.dir, sizeof(g_cache.dir)))
+        return false;
+
+    g_cache.renderer = hash64(renderer, strlen(renderer), HASH_SEED);
+    g_cache.renderer = hash64(version, strlen(version), g_cache.renderer);
+    g_cache.enabled = true;
+
+    return true;
+}
+
+static uint64_t cache_key(const char *vertex_src, const char *fragment_src) {
+    uint64_t key = hash64(vertex_src, strlen(vertex_src), g_cache.renderer);
+    return hash64(fragment_src, strlen(fragment_src), key);
+}
+
+static void cache_path(char *path, size_t size, uint64_t key) {
+    snprintf(path, size, "%s/%016llx.bin", g_cache.dir, (unsigned long long)key);
+}
+
+GLuint shader_cache_load(const char *vertex_src, const char *fragment_src) {
+    struct cache_header header;
+    char path[600];
+    void *binary = NULL;
+    GLuint program = 0;
+    GLint linked = 0;
+    uint64_t key;
+    FILE *fp;
+
+    if (!g_cache.enabled)
+        return 0;
+
+    key = cache_key(vertex_src, fragment_src);
+    cache_path(path, sizeof(path), key);
+
+    if (!(fp = fopen(path, "rb")))
+        return 0;
+
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != CACHE_MAGIC ||
+        header.version != CACHE_VERSION || header.key != key || !header.length)
+        goto invalid;
+
+    binary = malloc(header.length);
+    if (!binary || fread(binary, 1, header.length, fp) != header.length ||
+        hash64(binary, header.length, HASH_SEED) != header.checksum)
+        goto invalid;
+
+    program = glCreateProgram();
+    g_cache.program_binary(program, header.format, binary, header.length);
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    // Drivers may reject binaries at any time, e.g. after an update that kept
+    // the version string.
+    if (!linked) {
+        glDeleteProgram(program);
+        program = 0;
+        goto invalid;
+    }
+
+    free(binary);
+    fclose(fp);
+    return program;
+
+invalid:
+    free(binary);
+    fclose(fp);
+    remove(path);
+    return 0;
+}
+
+void shader_cache_store(GLuint program, const char *vertex_src, const char *fragment_src) {
+    struct cache_header header;
+    char path[600], tmp[610];
+    GLint length = 0;
+    GLenum format = 0;
+    void *binary;
+    bool ok;
+    FILE *fp;
+
+    if (!g_cache.enabled)
+        return;
+
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0 || !(binary = malloc(length)))
+        return;
+
+    g_cache.get_binary(program, length, &length, &format, binary);
+    if (glGetError() != GL_NO_ERROR || length <= 0) {
+        free(binary);
+        return;
+    }
+
+    header.magic = CACHE_MAGIC;
+    header.version = CACHE_VERSION;
+    header.key = cache_key(vertex_src, fragment_src);
+    header.format = format;
+    header.length = length;
+    header.checksum = hash64(binary, length, HASH_SEED);
+
+    cache_path(path, sizeof(path), header.key);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    // Write to a temporary file first so a crash never leaves a truncated
+    // entry behind.
+    if ((fp = fopen(tmp, "wb"))) {
+        ok = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(binary, 1, length, fp) == (size_t)length;
+        ok = !fclose(fp) && ok;
+
+        if (!ok || rename(tmp, path))
+            remove(tmp);
+    }
+
+    free(binary);
+}
+
+void shader_cache_hint(GLuint program) {
+    if (g_cache.enabled && g_cache.hint)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
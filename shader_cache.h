@@ -0,0 +1,22 @@
+#pragma once
+#include <stdbool.h>
+#include "glad.h"
+
+// On-disk cache of linked program binaries (GLES 3 / GL 4.1,
+// GL_OES_get_program_binary or GL_ARB_get_program_binary). Entries are keyed
+// by the shader sources and the GL renderer and version, so a driver update
+// simply misses the cache.
+//
+// Must be called once the GL context is current. Returns false if the driver
+// can't provide binaries, the other functions are no-ops then.
+bool shader_cache_init(void);
+
+// Returns a linked program restored from the cache, or 0 on a miss.
+GLuint shader_cache_load(const char *vertex_src, const char *fragment_src);
+
+// Stores a freshly linked program. The program should have been linked with
+// shader_cache_hint() applied.
+void shader_cache_store(GLuint program, const char *vertex_src, const char *fragment_src);
+
+// Asks the driver to keep the program binary retrievable, call before linking.
+void shader_cache_hint(GLuint program);
@@ -0,0 +1,140 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "shader_preset.h"
+
+// Drops trailing blanks and the quotes around a value.
+static void strip_value(char *value) {
+    size_t len = strlen(value);
+
+    while (len && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+        value[--len] = '\0';
+
+    if (len >= 2 && value[0] == '"' && value[len - 1] == '"') {
+        memmove(value, value + 1, len - 2);
+        value[len - 2] = '\0';
+    }
+}
+
+static bool parse_bool(const char *value) {
+    return !strcmp(value, "true") || !strcmp(value, "1");
+}
+
+static void set_shader_path(struct shader_pass_desc *pass, const char *preset, const char *value) {
+    const char *slash = strrchr(preset, '/');
+
+    // Bare names without an extension are built-in shaders, anything else is
+    // a file relative to the preset.
+    if (value[0] == '/' || !slash || !strchr(value, '.')) {
+        snprintf(pass->shader, sizeof(pass->shader), "%s", value);
+        return;
+    }
+
+    if (snprintf(pass->shader, sizeof(pass->shader), "%.*s/%s", (int)(slash - preset), preset, value) >= (int)sizeof(pass->shader))
+        fprintf(stderr, "shader: path of %s is too long\n", value);
+}
+
+bool shader_preset_load(const char *path, struct shader_preset *preset) {
+    char line[512];
+    unsigned i;
+    FILE *fp = fopen(path, "r");
+
+    if (!fp) {
+        fprintf(stderr, "shader: failed to open preset %s\n", path);
+        return false;
+    }
+
+    memset(preset, 0, sizeof(*preset));
+    for (i = 0; i < SHADER_MAX_PASSES; ++i) {
+        preset->pass[i].scale_x = 1.0f;
+        preset->pass[i].scale_y = 1.0f;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char key[64], value[256];
+        unsigned n;
+        int len;
+
+        if (line[0] == '#' || sscanf(line, " %63[^= \t] = %255[^\r\n]", key, value) != 2)
+            continue;
+
+        strip_value(value);
+
+        if (!strcmp(key, "shaders")) {
+            preset->passes = strtoul(value, NULL, 10);
+            continue;
+        }
+
+        // Per pass keys end in the pass index.
+        len = strlen(key);
+        while (len > 0 && key[len - 1] >= '0' && key[len - 1] <= '9')
+            len--;
+
+        if (!key[len])
+            continue;
+
+        n = strtoul(key + len, NULL, 10);
+        key[len] = '\0';
+
+        if (n >= SHADER_MAX_PASSES) {
+            fprintf(stderr, "shader: %s uses more than %d passes\n", path, SHADER_MAX_PASSES);
+            fclose(fp);
+            return false;
+        }
+
+        if (!strcmp(key, "shader"))
+            set_shader_path(&preset->pass[n], path, value);
+        else if (!strcmp(key, "filter_linear"))
+            preset->pass[n].filter_linear = parse_bool(value);
+        else if (!strcmp(key, "scale_type"))
+            preset->pass[n].scale_type = !strcmp(value, "viewport") ? SHADER_SCALE_VIEWPORT :
+                                         !strcmp(value, "absolute") ? SHADER_SCALE_ABSOLUTE : SHADER_SCALE_SOURCE;
+        else if (!strcmp(key, "scale"))
+            preset->pass[n].scale_x = preset->pass[n].scale_y = strtof(value, NULL);
+        else if (!strcmp(key, "scale_x"))
+            preset->pass[n].scale_x = strtof(value, NULL);
+        else if (!strcmp(key, "scale_y"))
+            preset->pass[n].scale_y = strtof(value, NULL);
+    }
+
+    fclose(fp);
+
+    if (!preset->passes || preset->passes > SHADER_MAX_PASSES) {
+        fprintf(stderr, "shader: %s has an invalid number of passes\n", path);
+        return false;
+    }
+
+    for (i = 0; i < preset->passes; ++i) {
+        if (!preset->pass[i].shader[0]) {
+            fprintf(stderr, "shader: %s is missing shader%u\n", path, i);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+char *shader_preset_read_source(const char *path) {
+    char *data;
+    long size;
+    FILE *fp = fopen(path, "rb");
+
+    if (!fp)
+        return NULL;
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    data = size >= 0 ? malloc(size + 1) : NULL;
+    if (data && fread(data, 1, size, fp) != (size_t)size) {
+        free(data);
+        data = NULL;
+    }
+
+    if (data)
+        data[size] = '\0';
+
+    fclose(fp);
+    return data;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <stdbool.h>
+
+#define SHADER_MAX_PASSES 8
+
+enum shader_scale_type {
+    SHADER_SCALE_SOURCE,   // multiple of the pass input size
+    SHADER_SCALE_VIEWPORT, // multiple of the output viewport size
+    SHADER_SCALE_ABSOLUTE, // fixed size in pixels
+};
+
+struct shader_pass_desc {
+    char shader[256];      // built-in shader name or fragment shader path
+    bool filter_linear;
+    enum shader_scale_type scale_type;
+    float scale_x, scale_y;
+};
+
+struct shader_preset {
+    unsigned passes;
+    struct shader_pass_desc pass[SHADER_MAX_PASSES];
+};
+
+// Parses a preset file of "key = value" lines:
+//
+//   shaders = 2
+//   shader0 = scanline            built-in name, or a path relative to the preset
+//   filter_linear0 = false
+//   scale_type0 = source          source, viewport or absolute
+//   scale0 = 2.0                  or scale_x0 / scale_y0
+//
+// The last pass always renders to the viewport, its scale is ignored.
+bool shader_preset_load(const char *path, struct shader_preset *preset);
+
+// Reads a whole shader source file, returns a malloc'ed string or NULL.
+char *shader_preset_read_source(const char *path);
@@ -0,0 +1,192 @@
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "hash.h"
+#include "sram.h"
+
+#define SRAM_BLOCK 1024
+// Frames between checks, a save in progress usually finishes well within it.
+#define SRAM_CHECK_FRAMES 30
+
+static struct {
+    bool active;
+    char path[1024];
+    const uint8_t *ram;
+    size_t size, blocks;
+    uint64_t *hashes;
+    unsigned frame;
+
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *cond;
+    bool quit, dirty;
+
+    uint8_t *snapshot; // guarded by lock
+    uint8_t *out;      // writer side
+    unsigned writes;
+} g_sram;
+
+static bool write_file(const uint8_t *data, size_t size) {
+    char tmp[1040];
+    bool ok;
+    FILE *fp;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_sram.path);
+    if (!(fp = fopen(tmp, "wb")))
+        return false;
+
+    ok = fwrite(data, 1, size, fp) == size && !fflush(fp);
+#ifndef _WIN32
+    // The data has to be on disk before the rename makes it the save.
+    ok = ok && !fsync(fileno(fp));
+#endif
+    ok = !fclose(fp) && ok;
+
+    if (!ok || rename(tmp, g_sram.path)) {
+        remove(tmp);
+        return false;
+    }
+
+    return true;
+}
+
+static int writer_thread(void *data) {
+    (void)data;
+
+    SDL_LockMutex(g_sram.lock);
+    for (;;) {
+        while (!g_sram.dirty && !g_sram.quit)
+            SDL_CondWait(g_sram.cond, g_sram.lock);
+        if (!g_sram.dirty)
+            break;
+
+        memcpy(g_sram.out, g_sram.snapshot, g_sram.size);
+        g_sram.dirty = false;
+        SDL_UnlockMutex(g_sram.lock);
+
+        if (write_file(g_sram.out, g_sram.size))
+            g_sram.writes++;
+        else
+            fprintf(stderr, "sram: failed to write %s\n", g_sram.path);
+
+        SDL_LockMutex(g_sram.lock);
+    }
+    SDL_UnlockMutex(g_sram.lock);
+
+    return 0;
+}
+
+static uint64_t block_hash(size_t block) {
+    size_t offset = block * SRAM_BLOCK;
+    size_t len = g_sram.size - offset < SRAM_BLOCK ? g_sram.size - offset : SRAM_BLOCK;
+
+    return hash64(g_sram.ram + offset, len, HASH_SEED);
+}
+
+bool sram_open(const char *path, void *data, size_t size) {
+    size_t i;
+    FILE *fp;
+
+    memset(&g_sram, 0, sizeof(g_sram));
+    snprintf(g_sram.path, sizeof(g_sram.path), "%s", path);
+    g_sram.ram = data;
+    g_sram.size = size;
+    g_sram.blocks = (size + SRAM_BLOCK - 1) / SRAM_BLOCK;
+
+    if ((fp = fopen(path, "rb"))) {
+        size_t n = fread(data, 1, size, fp);
+
+        if (n != size || fgetc(fp) != EOF)
+            fprintf(stderr, "sram: %s does not match the %zu bytes of save RAM\n", path, size);
+        fclose(fp);
+        printf("Loaded save RAM from %s\r\n", path);
+    }
+
+    g_sram.hashes = malloc(g_sram.blocks * sizeof(*g_sram.hashes));
+    g_sram.snapshot = malloc(size);
+    g_sram.out = malloc(size);
+    if (!g_sram.hashes || !g_sram.snapshot || !g_sram.out)
+        return false;
+
+    for (i = 0; i < g_sram.blocks; ++i)
+        g_sram.hashes[i] = block_hash(i);
+    memcpy(g_sram.snapshot, data, size);
+
+    g_sram.lock = SDL_CreateMutex();
+    g_sram.cond = SDL_CreateCond();
+    if (!g_sram.lock || !g_sram.cond)
+        return false;
+
+    g_sram.thread = SDL_CreateThread(writer_thread, "sram", NULL);
+    if (!g_sram.thread)
+        return false;
+
+    g_sram.active = true;
+    return true;
+}
+
+// Copies the blocks that changed since the last check into the snapshot.
+static void sram_check(void) {
+    bool locked = false;
+    size_t i;
+
+    for (i = 0; i < g_sram.blocks; ++i) {
+        uint64_t h = block_hash(i);
+        size_t offset = i * SRAM_BLOCK;
+
+        if (h == g_sram.hashes[i])
+            continue;
+
+        if (!locked) {
+            SDL_LockMutex(g_sram.lock);
+            locked = true;
+        }
+
+        g_sram.hashes[i] = h;
+        memcpy(g_sram.snapshot + offset, g_sram.ram + offset,
+            g_sram.size - offset < SRAM_BLOCK ? g_sram.size - offset : SRAM_BLOCK);
+    }
+
+    if (locked) {
+        g_sram.dirty = true;
+        SDL_CondSignal(g_sram.cond);
+        SDL_UnlockMutex(g_sram.lock);
+    }
+}
+
+void sram_frame(void) {
+    if (!g_sram.active || ++g_sram.frame < SRAM_CHECK_FRAMES)
+        return;
+
+    g_sram.frame = 0;
+    sram_check();
+}
+
+void sram_close(void) {
+    if (g_sram.active) {
+        sram_check();
+
+        SDL_LockMutex(g_sram.lock);
+        g_sram.quit = true;
+        SDL_CondSignal(g_sram.cond);
+        SDL_UnlockMutex(g_sram.lock);
+        SDL_WaitThread(g_sram.thread, NULL);
+
+        if (g_sram.writes)
+            printf("Saved save RAM to %s\r\n", g_sram.path);
+    }
+
+    if (g_sram.cond)
+        SDL_DestroyCond(g_sram.cond);
+    if (g_sram.lock)
+        SDL_DestroyMutex(g_sram.lock);
+    free(g_sram.hashes);
+    free(g_sram.snapshot);
+    free(g_sram.out);
+
+    memset(&g_sram, 0, sizeof(g_sram));
+}
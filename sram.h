@@ -0,0 +1,17 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+// Keeps a core's battery backed save RAM in a file. The RAM is hashed in
+// blocks every few frames, changed blocks are copied into a snapshot and a
+// background thread writes it through a temporary file and a rename, so the
+// frame loop never touches the disk and a crash never leaves a torn save.
+
+// Loads path into data if it exists and starts the writer.
+bool sram_open(const char *path, void *data, size_t size);
+
+// Called once per frame, cheap unless the RAM changed.
+void sram_frame(void);
+
+// Writes out the final contents and stops the writer.
+void sram_close(void);
@@ -0,0 +1,381 @@
+#include <SDL.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "telemetry.h"
+
+// Values below 2 * SUB get a bucket each, every power of two above is
+// split into SUB buckets.
+#define SUB_BITS 4
+#define SUB (1 << SUB_BITS)
+// Values from 2^MAX_BITS usec, about a minute, go to the last bucket.
+#define MAX_BITS 26
+#define BUCKETS ((MAX_BITS - SUB_BITS + 1) * SUB)
+#define TEXT_SIZE (128 * 1024)
+// Longest the thread sleeps before checking for the end of the run.
+#define POLL_MS 100
+
+struct histogram {
+    atomic_uint_fast64_t counts[BUCKETS];
+    atomic_uint_fast64_t sum, max;
+};
+
+struct snapshot {
+    uint64_t counts[TELEMETRY_METRICS][BUCKETS];
+    uint64_t sum[TELEMETRY_METRICS], max[TELEMETRY_METRICS];
+    uint64_t counters[TELEMETRY_COUNTERS];
+};
+
+static const char *const g_metric_names[TELEMETRY_METRICS] = {
+    "run", "upload", "swap", "audio_fill",
+};
+
+static const char *const g_metric_help[TELEMETRY_METRICS] = {
+    "Time in retro_run without the video callback.",
+    "Time uploading and drawing a frame.",
+    "Time in SDL_GL_SwapWindow.",
+    "Audio queued after a frame, in seconds of playback.",
+};
+
+static const char *const g_counter_names[TELEMETRY_COUNTERS] = {
+    "frames", "dropped_frames", "duplicated_frames",
+};
+
+static struct {
+    bool active;
+    char target[1024];
+    enum telemetry_format format;
+    unsigned interval_ms;
+
+    // Written by the recording thread only, read by the snapshot thread.
+    struct histogram hist[TELEMETRY_METRICS];
+    atomic_uint_fast64_t counters[TELEMETRY_COUNTERS];
+
+    SDL_Thread *thread;
+    SDL_atomic_t quit;
+    int listen_fd;
+
+    // Snapshot thread side.
+    struct snapshot current, previous;
+    char *text;
+    size_t text_len;
+} g_tel = { .listen_fd = -1 };
+
+bool telemetry_parse_format(const char *name, enum telemetry_format *format) {
+    if (!strcmp(name, "prometheus"))
+        *format = TELEMETRY_PROMETHEUS;
+    else if (!strcmp(name, "json"))
+        *format = TELEMETRY_JSON;
+    else
+        return false;
+    return true;
+}
+
+// A single writer needs no read-modify-write, a relaxed load and store keep
+// the frame loop free of locked instructions.
+static void bump(atomic_uint_fast64_t *v, uint64_t n) {
+    atomic_store_explicit(v, atomic_load_explicit(v, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+static unsigned bucket_of(uint64_t v) {
+    unsigned shift = 0;
+
+    if (v >= 1ull << MAX_BITS)
+        v = (1ull << MAX_BITS) - 1;
+    if (v < 2 * SUB)
+        return (unsigned)v;
+
+    while (v >> shift >= 2 * SUB)
+        shift++;
+    return (shift + 1) * SUB + (unsigned)(v >> shift) - SUB;
+}
+
+// Values in bucket i are below this.
+static uint64_t bucket_end(unsigned i) {
+    if (i < 2 * SUB)
+        return i + 1;
+    return (uint64_t)(i % SUB + SUB + 1) << (i / SUB - 1);
+}
+
+void telemetry_record(enum telemetry_metric metric, uint64_t usec) {
+    struct histogram *h = &g_tel.hist[metric];
+
+    if (!g_tel.active)
+        return;
+
+    bump(&h->counts[bucket_of(usec)], 1);
+    bump(&h->sum, usec);
+    if (usec > atomic_load_explicit(&h->max, memory_order_relaxed))
+        atomic_store_explicit(&h->max, usec, memory_order_relaxed);
+}
+
+void telemetry_count(enum telemetry_counter counter, unsigned n) {
+    if (g_tel.active)
+        bump(&g_tel.counters[counter], n);
+}
+
+static void snapshot_take(struct snapshot *s) {
+    unsigned m, i;
+
+    for (m = 0; m < TELEMETRY_METRICS; ++m) {
+        for (i = 0; i < BUCKETS; ++i)
+            s->counts[m][i] = atomic_load_explicit(&g_tel.hist[m].counts[i], memory_order_relaxed);
+        s->sum[m] = atomic_load_explicit(&g_tel.hist[m].sum, memory_order_relaxed);
+        s->max[m] = atomic_load_explicit(&g_tel.hist[m].max, memory_order_relaxed);
+    }
+    for (i = 0; i < TELEMETRY_COUNTERS; ++i)
+        s->counters[i] = atomic_load_explicit(&g_tel.counters[i], memory_order_relaxed);
+}
+
+static void put(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(g_tel.text + g_tel.text_len, TEXT_SIZE - g_tel.text_len, fmt, ap);
+    va_end(ap);
+
+    if (n > 0)
+        g_tel.text_len += (size_t)n < TEXT_SIZE - g_tel.text_len ? (size_t)n : TEXT_SIZE - 1 - g_tel.text_len;
+}
+
+// Cumulative buckets, only the non-empty ones. The bucket counts are read
+// one by one while the frame loop keeps recording, so the total is taken
+// from them rather than from a separate counter.
+static void format_prometheus(const struct snapshot *s) {
+    unsigned m, i;
+
+    for (m = 0; m < TELEMETRY_METRICS; ++m) {
+        const char *name = g_metric_names[m];
+        uint64_t total = 0;
+
+        put("# HELP sdlarch_%s_seconds %s\n", name, g_metric_help[m]);
+        put("# TYPE sdlarch_%s_seconds histogram\n", name);
+        for (i = 0; i < BUCKETS; ++i) {
+            if (!s->counts[m][i])
+                continue;
+            total += s->counts[m][i];
+            put("sdlarch_%s_seconds_bucket{le=\"%.6f\"} %llu\n", name, bucket_end(i) / 1e6,
+                (unsigned long long)total);
+        }
+        put("sdlarch_%s_seconds_bucket{le=\"+Inf\"} %llu\n", name, (unsigned long long)total);
+        put("sdlarch_%s_seconds_sum %.6f\n", name, s->sum[m] / 1e6);
+        put("sdlarch_%s_seconds_count %llu\n", name, (unsigned long long)total);
+    }
+
+    for (i = 0; i < TELEMETRY_COUNTERS; ++i) {
+        put("# TYPE sdlarch_%s_total counter\n", g_counter_names[i]);
+        put("sdlarch_%s_total %llu\n", g_counter_names[i], (unsigned long long)s->counters[i]);
+    }
+}
+
+// Highest value of the bucket holding the q quantile of the counts.
+static uint64_t quantile(const uint64_t *counts, uint64_t total, double q) {
+    uint64_t rank = (uint64_t)(q * total + 0.5), seen = 0;
+    unsigned i;
+
+    if (!rank)
+        rank = 1;
+    for (i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank)
+            return bucket_end(i) - 1;
+    }
+    return 0;
+}
+
+// Percentiles cover the frames since the previous snapshot, the totals the
+// whole run.
+static void format_json(const struct snapshot *s, const struct snapshot *prev) {
+    uint64_t delta[BUCKETS];
+    unsigned m, i;
+
+    put("{\n  \"interval_ms\": %u", g_tel.interval_ms);
+    for (i = 0; i < TELEMETRY_COUNTERS; ++i)
+        put(",\n  \"%s\": %llu", g_counter_names[i], (unsigned long long)s->counters[i]);
+
+    for (m = 0; m < TELEMETRY_METRICS; ++m) {
+        uint64_t total = 0, n = 0;
+
+        for (i = 0; i < BUCKETS; ++i) {
+            total += s->counts[m][i];
+            delta[i] = s->counts[m][i] - prev->counts[m][i];
+            n += delta[i];
+        }
+
+        put(",\n  \"%s_us\": {\"count\": %llu, \"sum\": %llu, \"max\": %llu, \"interval\": {\"count\": %llu",
+            g_metric_names[m], (unsigned long long)total, (unsigned long long)s->sum[m],
+            (unsigned long long)s->max[m], (unsigned long long)n);
+        if (n)
+            put(", \"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu",
+                (double)(s->sum[m] - prev->sum[m]) / n,
+                (unsigned long long)quantile(delta, n, 0.50), (unsigned long long)quantile(delta, n, 0.90),
+                (unsigned long long)quantile(delta, n, 0.99), (unsigned long long)quantile(delta, n, 1.0));
+        put("}}");
+    }
+    put("\n}\n");
+}
+
+// Written next to the target and renamed over it, so readers never see a
+// partial snapshot.
+static void write_file(void) {
+    char tmp[1040];
+    FILE *fp;
+    bool ok;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_tel.target);
+    fp = fopen(tmp, "wb");
+    if (!fp)
+        return;
+
+    ok = fwrite(g_tel.text, 1, g_tel.text_len, fp) == g_tel.text_len;
+    ok = !fclose(fp) && ok;
+    if (!ok || rename(tmp, g_tel.target))
+        remove(tmp);
+}
+
+static void publish(void) {
+    snapshot_take(&g_tel.current);
+
+    g_tel.text_len = 0;
+    if (g_tel.format == TELEMETRY_JSON)
+        format_json(&g_tel.current, &g_tel.previous);
+    else
+        format_prometheus(&g_tel.current);
+    g_tel.previous = g_tel.current;
+
+    if (g_tel.listen_fd < 0)
+        write_file();
+}
+
+// Every client gets the latest snapshot and is disconnected. A client that
+// does not read in time gets a truncated one rather than stalling the thread.
+static void serve_clients(void) {
+    int fd;
+
+    while ((fd = accept(g_tel.listen_fd, NULL, NULL)) >= 0) {
+        size_t done = 0;
+        ssize_t n;
+
+        while (done < g_tel.text_len &&
+               (n = send(fd, g_tel.text + done, g_tel.text_len - done, MSG_DONTWAIT | MSG_NOSIGNAL)) > 0)
+            done += n;
+        close(fd);
+    }
+}
+
+static int telemetry_thread(void *data) {
+    Uint32 next = SDL_GetTicks() + g_tel.interval_ms;
+
+    (void)data;
+    publish();
+
+    while (!SDL_AtomicGet(&g_tel.quit)) {
+        Sint32 left = (Sint32)(next - SDL_GetTicks());
+
+        if (left <= 0) {
+            publish();
+            next += g_tel.interval_ms;
+            // Skip the periods missed while suspended instead of catching up.
+            if ((Sint32)(next - SDL_GetTicks()) <= 0)
+                next = SDL_GetTicks() + g_tel.interval_ms;
+            continue;
+        }
+
+        if (left > POLL_MS)
+            left = POLL_MS;
+        if (g_tel.listen_fd >= 0) {
+            struct pollfd pfd = { g_tel.listen_fd, POLLIN, 0 };
+
+            if (poll(&pfd, 1, left) > 0)
+                serve_clients();
+        } else {
+            SDL_Delay(left);
+        }
+    }
+
+    publish();
+    return 0;
+}
+
+static bool listen_unix(const char *path) {
+    struct sockaddr_un addr;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return false;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    g_tel.listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (g_tel.listen_fd < 0)
+        return false;
+
+    // A socket left behind by an earlier run would fail the bind.
+    unlink(path);
+    if (bind(g_tel.listen_fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(g_tel.listen_fd, 4) < 0) {
+        fprintf(stderr, "telemetry: cannot listen on %s: %s\n", path, strerror(errno));
+        close(g_tel.listen_fd);
+        g_tel.listen_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+bool telemetry_open(const struct telemetry_config *config) {
+    const char *path = config->target;
+
+    telemetry_close();
+
+    if (!config->interval_ms)
+        return false;
+
+    if (!strncmp(path, "unix:", 5)) {
+        path += 5;
+        if (!listen_unix(path))
+            return false;
+    }
+    snprintf(g_tel.target, sizeof(g_tel.target), "%s", path);
+    g_tel.format = config->format;
+    g_tel.interval_ms = config->interval_ms;
+
+    g_tel.text = malloc(TEXT_SIZE);
+    if (!g_tel.text) {
+        telemetry_close();
+        return false;
+    }
+
+    g_tel.active = true;
+    SDL_AtomicSet(&g_tel.quit, 0);
+    g_tel.thread = SDL_CreateThread(telemetry_thread, "telemetry", NULL);
+    if (!g_tel.thread) {
+        telemetry_close();
+        return false;
+    }
+
+    return true;
+}
+
+void telemetry_close(void) {
+    if (g_tel.thread) {
+        SDL_AtomicSet(&g_tel.quit, 1);
+        SDL_WaitThread(g_tel.thread, NULL);
+    }
+
+    if (g_tel.listen_fd >= 0) {
+        close(g_tel.listen_fd);
+        unlink(g_tel.target);
+    }
+    free(g_tel.text);
+
+    memset(&g_tel, 0, sizeof(g_tel));
+    g_tel.listen_fd = -1;
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+
+// Continuous frame statistics for monitoring. The frame loop records into
+// log-linear histograms (16 buckets per power of two, so within about 6% of
+// the value) with plain relaxed atomic stores and no locks, and a thread
+// snapshots them every interval to a file, replaced atomically, or to
+// clients of a Unix socket. Recording must happen on one thread.
+
+enum telemetry_metric {
+    TELEMETRY_RUN,        // retro_run without the video callback, usec
+    TELEMETRY_UPLOAD,     // video_draw, texture upload and draw, usec
+    TELEMETRY_SWAP,       // SDL_GL_SwapWindow, usec
+    TELEMETRY_AUDIO_FILL, // audio queued after a frame, usec of playback
+    TELEMETRY_METRICS
+};
+
+enum telemetry_counter {
+    TELEMETRY_FRAMES,
+    TELEMETRY_DROPPED,    // refresh periods missed between two swaps
+    TELEMETRY_DUPLICATED, // frames the core reported as dupes
+    TELEMETRY_COUNTERS
+};
+
+enum telemetry_format {
+    TELEMETRY_PROMETHEUS, // text exposition format, cumulative histograms
+    TELEMETRY_JSON,       // percentiles over the last interval and totals
+};
+
+struct telemetry_config {
+    // A file path, or unix:<path> to serve each client the latest snapshot.
+    const char *target;
+    enum telemetry_format format;
+    unsigned interval_ms;
+};
+
+bool telemetry_parse_format(const char *name, enum telemetry_format *format);
+
+bool telemetry_open(const struct telemetry_config *config);
+void telemetry_record(enum telemetry_metric metric, uint64_t usec);
+void telemetry_count(enum telemetry_counter counter, unsigned n);
+
+// Writes a last snapshot and stops the thread.
+void telemetry_close(void);
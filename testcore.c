@@ -0,0 +1,622 @@
+// Tiny synthetic libretro core used to exercise and benchmark the frontend
+// without any third-party cores. It does as little work as possible itself,
+// and every frame is a function of the frame counter and the joypad state
+// only, so its output hashes are stable across runs and hosts.
+//
+// The content file is an optional list of "key = value" lines:
+//
+//   width, height        frame size (default 320x240)
+//   max_width, max_height
+//                        texture size reported to the frontend
+//   format               0rgb1555, xrgb8888 or rgb565 (default xrgb8888)
+//   animate              1 redraws the whole test pattern every frame,
+//                        0 only touches the first pixel (default 0)
+//   dupe                 report every Nth frame as a dupe (default 0, off)
+//   hw                   1 renders through SET_HW_RENDER instead (default 0)
+//   fps, sample_rate     timing reported to the frontend
+//   audio                batch, sample, callback or none (default batch),
+//                        callback registers SET_AUDIO_CALLBACK and writes
+//                        audio_chunk frames (default 512) per call
+//   audio_chunk          frames per audio_sample_batch call (default all)
+//   env_calls            extra environment calls per frame (default 0)
+//   env_cmd              command used for those calls (default 17,
+//                        RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE)
+//   geometry_switch      every N frames toggle between the full and half
+//                        height with SET_GEOMETRY (default 0, off)
+//   av_switch            every N frames toggle between the full and half
+//                        height and sample rate with SET_SYSTEM_AV_INFO
+//                        (default 0, off)
+//   save_ram             bytes of battery backed save RAM (default 0)
+//   save_every           every N frames store the frame counter in the next
+//                        4 bytes of save RAM, wrapping around (default 0, off)
+//   system_ram           bytes of system RAM, rounded up to a power of two,
+//                        starting with the frame counter, phase, x and y
+//                        as 32-bit values, read back every frame so
+//                        frontend writes take effect (default 0)
+//   memory_map           1 describes system RAM with SET_MEMORY_MAPS at
+//                        0x7e0000, up to 8 KiB of it mirrored at the start
+//                        of every 64 KiB bank below 0x400000 (default 0)
+//   players              2 also reads the second pad, whose directions move
+//                        the pattern 16 pixels at a time (default 1)
+//
+// retro_cheat_set accepts "x=<n>" and "y=<n>", which pin the pattern offset.
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libretro.h"
+
+#define GL_COLOR_BUFFER_BIT 0x00004000
+#define GL_FRAMEBUFFER 0x8D40
+
+static retro_environment_t environ_cb;
+static retro_video_refresh_t video_cb;
+static retro_audio_sample_t audio_cb;
+static retro_audio_sample_batch_t audio_batch_cb;
+static retro_input_poll_t input_poll_cb;
+static retro_input_state_t input_state_cb;
+
+enum audio_mode {
+    AUDIO_BATCH,
+    AUDIO_SAMPLE,
+    AUDIO_CALLBACK,
+    AUDIO_NONE,
+};
+
+static struct {
+    unsigned width, height;
+    unsigned max_width, max_height;
+    enum retro_pixel_format format;
+    unsigned animate;
+    unsigned dupe;
+    unsigned hw;
+    double fps;
+    double sample_rate;
+    enum audio_mode audio;
+    unsigned audio_chunk;
+    unsigned env_calls;
+    unsigned env_cmd;
+    unsigned geometry_switch;
+    unsigned av_switch;
+    unsigned save_ram;
+    unsigned save_every;
+    unsigned system_ram;
+    unsigned memory_map;
+    unsigned players;
+} config;
+
+static uint8_t *frame_buf;
+static unsigned frame_pitch;
+static int16_t *audio_buf;
+static unsigned audio_frames;
+static uint8_t *save_ram;
+static uint8_t *system_ram;
+
+// Audio callback state, separate from the frame state since the frontend
+// may call it from another thread.
+#define CALLBACK_CHUNK 512
+static int16_t callback_buf[CALLBACK_CHUNK * 2];
+static uint32_t callback_phase;
+static bool callback_enabled = true;
+
+static struct retro_hw_render_callback hw_render;
+static void (*gl_bind_framebuffer)(unsigned target, unsigned fb);
+static void (*gl_clear_color)(float r, float g, float b, float a);
+static void (*gl_clear)(unsigned mask);
+
+static struct {
+    uint32_t frame;
+    uint32_t phase;
+    int32_t x, y;
+} state;
+
+static struct {
+    bool x, y;
+    int32_t x_value, y_value;
+} pins;
+
+static void config_defaults(void) {
+    memset(&config, 0, sizeof(config));
+    config.width = 320;
+    config.height = 240;
+    config.format = RETRO_PIXEL_FORMAT_XRGB8888;
+    config.fps = 60.0;
+    config.sample_rate = 48000.0;
+    config.audio = AUDIO_BATCH;
+    config.env_cmd = RETRO_ENVIRONMENT_GET_VARIABLE_UPDATE;
+}
+
+static void config_set(const char *key, const char *value) {
+    unsigned n = strtoul(value, NULL, 10);
+
+    if (!strcmp(key, "width"))
+        config.width = n;
+    else if (!strcmp(key, "height"))
+        config.height = n;
+    else if (!strcmp(key, "max_width"))
+        config.max_width = n;
+    else if (!strcmp(key, "max_height"))
+        config.max_height = n;
+    else if (!strcmp(key, "format"))
+        config.format = !strcmp(value, "0rgb1555") ? RETRO_PIXEL_FORMAT_0RGB1555 :
+                        !strcmp(value, "rgb565") ? RETRO_PIXEL_FORMAT_RGB565 : RETRO_PIXEL_FORMAT_XRGB8888;
+    else if (!strcmp(key, "animate"))
+        config.animate = n;
+    else if (!strcmp(key, "dupe"))
+        config.dupe = n;
+    else if (!strcmp(key, "hw"))
+        config.hw = n;
+    else if (!strcmp(key, "fps"))
+        config.fps = strtod(value, NULL);
+    else if (!strcmp(key, "sample_rate"))
+        config.sample_rate = strtod(value, NULL);
+    else if (!strcmp(key, "audio"))
+        config.audio = !strcmp(value, "sample") ? AUDIO_SAMPLE : !strcmp(value, "callback") ? AUDIO_CALLBACK :
+                       !strcmp(value, "none") ? AUDIO_NONE : AUDIO_BATCH;
+    else if (!strcmp(key, "audio_chunk"))
+        config.audio_chunk = n;
+    else if (!strcmp(key, "env_calls"))
+        config.env_calls = n;
+    else if (!strcmp(key, "env_cmd"))
+        config.env_cmd = n;
+    else if (!strcmp(key, "geometry_switch"))
+        config.geometry_switch = n;
+    else if (!strcmp(key, "av_switch"))
+        config.av_switch = n;
+    else if (!strcmp(key, "save_ram"))
+        config.save_ram = n;
+    else if (!strcmp(key, "save_every"))
+        config.save_every = n;
+    else if (!strcmp(key, "system_ram"))
+        config.system_ram = n;
+    else if (!strcmp(key, "memory_map"))
+        config.memory_map = n;
+    else if (!strcmp(key, "players"))
+        config.players = n;
+}
+
+static void config_load(const char *path) {
+    char line[256];
+    FILE *fp;
+
+    config_defaults();
+
+    if (!path || !(fp = fopen(path, "r")))
+        return;
+
+    while (fgets(line, sizeof(line), fp)) {
+        char key[64], value[128];
+
+        if (line[0] == '#')
+            continue;
+
+        if (sscanf(line, " %63[^= \t] = %127s", key, value) == 2)
+            config_set(key, value);
+    }
+
+    fclose(fp);
+}
+
+static void config_clamp(void) {
+    if (!config.width)
+        config.width = 1;
+    if (!config.height)
+        config.height = 1;
+    if (config.max_width < config.width)
+        config.max_width = config.width;
+    if (config.max_height < config.height)
+        config.max_height = config.height;
+    if (config.system_ram) {
+        unsigned size = sizeof(state);
+
+        while (size < config.system_ram)
+            size <<= 1;
+        config.system_ram = size;
+    }
+}
+
+static unsigned bytes_per_pixel(void) {
+    return config.format == RETRO_PIXEL_FORMAT_XRGB8888 ? 4 : 2;
+}
+
+static uint32_t pattern(unsigned x, unsigned y) {
+    uint32_t u = x + state.x + state.frame;
+    uint32_t v = y + state.y;
+    uint32_t r = (u ^ v) & 0xff, g = u & 0xff, b = v & 0xff;
+
+    switch (config.format) {
+    case RETRO_PIXEL_FORMAT_0RGB1555:
+        return (r >> 3) << 10 | (g >> 3) << 5 | (b >> 3);
+    case RETRO_PIXEL_FORMAT_RGB565:
+        return (r >> 3) << 11 | (g >> 2) << 5 | (b >> 3);
+    default:
+        return r << 16 | g << 8 | b;
+    }
+}
+
+static void put_pixel(unsigned x, unsigned y, uint32_t c) {
+    uint8_t *p = frame_buf + y * frame_pitch + x * bytes_per_pixel();
+
+    if (bytes_per_pixel() == 4)
+        memcpy(p, &c, 4);
+    else {
+        uint16_t s = c;
+        memcpy(p, &s, 2);
+    }
+}
+
+static void draw_pattern(void) {
+    unsigned x, y;
+
+    for (y = 0; y < config.height; ++y)
+        for (x = 0; x < config.width; ++x)
+            put_pixel(x, y, pattern(x, y));
+}
+
+void retro_set_environment(retro_environment_t cb) { environ_cb = cb; }
+void retro_set_video_refresh(retro_video_refresh_t cb) { video_cb = cb; }
+void retro_set_audio_sample(retro_audio_sample_t cb) { audio_cb = cb; }
+void retro_set_audio_sample_batch(retro_audio_sample_batch_t cb) { audio_batch_cb = cb; }
+void retro_set_input_poll(retro_input_poll_t cb) { input_poll_cb = cb; }
+void retro_set_input_state(retro_input_state_t cb) { input_state_cb = cb; }
+
+void retro_init(void) {
+    config_defaults();
+}
+
+void retro_deinit(void) {
+    free(frame_buf);
+    free(audio_buf);
+    free(save_ram);
+    free(system_ram);
+    frame_buf = NULL;
+    audio_buf = NULL;
+    save_ram = NULL;
+    system_ram = NULL;
+}
+
+unsigned retro_api_version(void) {
+    return RETRO_API_VERSION;
+}
+
+void retro_get_system_info(struct retro_system_info *info) {
+    memset(info, 0, sizeof(*info));
+    info->library_name = "testcore";
+    info->library_version = "1";
+    info->valid_extensions = NULL;
+    info->need_fullpath = true;
+}
+
+// Whether the given frame runs in the switched (half height) mode.
+static bool switched(uint32_t frame, unsigned every) {
+    return every && (frame / every) & 1;
+}
+
+static unsigned current_height(uint32_t frame) {
+    unsigned half = config.height > 1 ? config.height / 2 : 1;
+    return switched(frame, config.geometry_switch) || switched(frame, config.av_switch) ? half : config.height;
+}
+
+static double current_sample_rate(uint32_t frame) {
+    return switched(frame, config.av_switch) ? config.sample_rate / 2 : config.sample_rate;
+}
+
+static void get_av_info(struct retro_system_av_info *info, uint32_t frame) {
+    info->timing.fps = config.fps;
+    info->timing.sample_rate = current_sample_rate(frame);
+    info->geometry.base_width = config.width;
+    info->geometry.base_height = current_height(frame);
+    info->geometry.max_width = config.max_width;
+    info->geometry.max_height = config.max_height;
+    info->geometry.aspect_ratio = (float)config.width / config.height;
+}
+
+void retro_get_system_av_info(struct retro_system_av_info *info) {
+    get_av_info(info, state.frame);
+}
+
+// Reports a mode change at the first frame of every switch period.
+static void update_mode(void) {
+    struct retro_system_av_info av;
+
+    if (!state.frame)
+        return;
+
+    get_av_info(&av, state.frame);
+
+    if (config.av_switch && state.frame % config.av_switch == 0)
+        environ_cb(RETRO_ENVIRONMENT_SET_SYSTEM_AV_INFO, &av);
+    else if (config.geometry_switch && state.frame % config.geometry_switch == 0)
+        environ_cb(RETRO_ENVIRONMENT_SET_GEOMETRY, &av.geometry);
+}
+
+void retro_set_controller_port_device(unsigned port, unsigned device) {}
+
+static void store_state(void) {
+    if (system_ram)
+        memcpy(system_ram, &state, sizeof(state));
+}
+
+void retro_reset(void) {
+    memset(&state, 0, sizeof(state));
+    store_state();
+
+    if (frame_buf)
+        draw_pattern();
+}
+
+static void update_input(void) {
+    input_poll_cb();
+
+    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_LEFT))
+        state.x--;
+    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT))
+        state.x++;
+    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP))
+        state.y--;
+    if (input_state_cb(0, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_DOWN))
+        state.y++;
+
+    if (config.players > 1) {
+        if (input_state_cb(1, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_LEFT))
+            state.x -= 16;
+        if (input_state_cb(1, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_RIGHT))
+            state.x += 16;
+        if (input_state_cb(1, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_UP))
+            state.y -= 16;
+        if (input_state_cb(1, RETRO_DEVICE_JOYPAD, 0, RETRO_DEVICE_ID_JOYPAD_DOWN))
+            state.y += 16;
+    }
+
+    if (pins.x)
+        state.x = pins.x_value;
+    if (pins.y)
+        state.y = pins.y_value;
+}
+
+static void render_hw(void) {
+    if (!gl_clear) {
+        gl_bind_framebuffer = (void (*)(unsigned, unsigned))hw_render.get_proc_address("glBindFramebuffer");
+        gl_clear_color = (void (*)(float, float, float, float))hw_render.get_proc_address("glClearColor");
+        gl_clear = (void (*)(unsigned))hw_render.get_proc_address("glClear");
+    }
+
+    if (gl_bind_framebuffer && gl_clear_color && gl_clear) {
+        gl_bind_framebuffer(GL_FRAMEBUFFER, hw_render.get_current_framebuffer());
+        gl_clear_color((state.frame & 0xff) / 255.0f, (state.x & 0xff) / 255.0f, (state.y & 0xff) / 255.0f, 1.0f);
+        gl_clear(GL_COLOR_BUFFER_BIT);
+    }
+
+    video_cb(RETRO_HW_FRAME_BUFFER_VALID, config.width, current_height(state.frame), 0);
+}
+
+static void render_video(void) {
+    if (config.dupe && state.frame % config.dupe == config.dupe - 1) {
+        video_cb(NULL, config.width, current_height(state.frame), frame_pitch);
+        return;
+    }
+
+    if (config.hw) {
+        render_hw();
+        return;
+    }
+
+    if (config.animate)
+        draw_pattern();
+    else
+        put_pixel(0, 0, state.frame);
+
+    video_cb(frame_buf, config.width, current_height(state.frame), frame_pitch);
+}
+
+static void render_audio(void) {
+    unsigned i, chunk, frames;
+    double rate = current_sample_rate(state.frame);
+
+    // Spread the fractional samples per frame so the long-term rate is exact.
+    frames = (unsigned)((state.frame + 1) * rate / config.fps) -
+             (unsigned)(state.frame * rate / config.fps);
+    if (frames > audio_frames)
+        frames = audio_frames;
+
+    // Square wave, its period drifts with the frame counter.
+    for (i = 0; i < frames; ++i) {
+        int16_t s = (state.phase++ / (50 + (state.frame & 63))) & 1 ? 0x1000 : -0x1000;
+        audio_buf[i * 2 + 0] = s;
+        audio_buf[i * 2 + 1] = s;
+    }
+
+    switch (config.audio) {
+    case AUDIO_SAMPLE:
+        for (i = 0; i < frames; ++i)
+            audio_cb(audio_buf[i * 2 + 0], audio_buf[i * 2 + 1]);
+        break;
+    case AUDIO_BATCH:
+        chunk = config.audio_chunk ? config.audio_chunk : frames;
+        for (i = 0; i < frames; i += chunk)
+            audio_batch_cb(audio_buf + i * 2, frames - i < chunk ? frames - i : chunk);
+        break;
+    default:
+        break;
+    }
+}
+
+static void audio_callback(void) {
+    unsigned i, frames = config.audio_chunk ? config.audio_chunk : CALLBACK_CHUNK;
+
+    if (!callback_enabled)
+        return;
+
+    if (frames > CALLBACK_CHUNK)
+        frames = CALLBACK_CHUNK;
+
+    for (i = 0; i < frames; ++i) {
+        int16_t s = (callback_phase++ / 50) & 1 ? 0x1000 : -0x1000;
+        callback_buf[i * 2 + 0] = s;
+        callback_buf[i * 2 + 1] = s;
+    }
+
+    audio_batch_cb(callback_buf, frames);
+}
+
+static void audio_set_state(bool enabled) {
+    callback_enabled = enabled;
+}
+
+static void update_save_ram(void) {
+    unsigned slots = config.save_ram / 4;
+
+    if (!config.save_every || !slots || state.frame % config.save_every != config.save_every - 1)
+        return;
+
+    memcpy(save_ram + (state.frame / config.save_every % slots) * 4, &state.frame, 4);
+}
+
+void retro_run(void) {
+    unsigned i;
+
+    if (system_ram)
+        memcpy(&state, system_ram, sizeof(state));
+
+    update_input();
+    update_mode();
+
+    for (i = 0; i < config.env_calls; ++i) {
+        bool updated = false;
+        environ_cb(config.env_cmd, &updated);
+    }
+
+    render_video();
+    render_audio();
+    update_save_ram();
+    state.frame++;
+    store_state();
+}
+
+size_t retro_serialize_size(void) {
+    return sizeof(state);
+}
+
+bool retro_serialize(void *data, size_t size) {
+    if (size < sizeof(state))
+        return false;
+
+    memcpy(data, &state, sizeof(state));
+    return true;
+}
+
+bool retro_unserialize(const void *data, size_t size) {
+    if (size < sizeof(state))
+        return false;
+
+    memcpy(&state, data, sizeof(state));
+    store_state();
+
+    if (frame_buf && !config.animate)
+        draw_pattern();
+
+    return true;
+}
+
+void retro_cheat_reset(void) {
+    memset(&pins, 0, sizeof(pins));
+}
+
+void retro_cheat_set(unsigned index, bool enabled, const char *code) {
+    int value;
+
+    if (!enabled || !code)
+        return;
+
+    if (sscanf(code, "x=%d", &value) == 1) {
+        pins.x = true;
+        pins.x_value = value;
+    } else if (sscanf(code, "y=%d", &value) == 1) {
+        pins.y = true;
+        pins.y_value = value;
+    }
+}
+
+bool retro_load_game(const struct retro_game_info *game) {
+    enum retro_pixel_format fmt;
+
+    config_load(game ? game->path : NULL);
+    config_clamp();
+
+    fmt = config.format;
+    if (!environ_cb(RETRO_ENVIRONMENT_SET_PIXEL_FORMAT, &fmt))
+        return false;
+
+    if (config.hw) {
+        memset(&hw_render, 0, sizeof(hw_render));
+        hw_render.context_type = RETRO_HW_CONTEXT_OPENGLES2;
+        if (!environ_cb(RETRO_ENVIRONMENT_SET_HW_RENDER, &hw_render))
+            return false;
+    }
+
+    if (config.audio == AUDIO_CALLBACK) {
+        struct retro_audio_callback cb = { audio_callback, audio_set_state };
+        if (!environ_cb(RETRO_ENVIRONMENT_SET_AUDIO_CALLBACK, &cb))
+            return false;
+    }
+
+    frame_pitch = config.max_width * bytes_per_pixel();
+    frame_buf = calloc(config.max_height, frame_pitch);
+
+    // Room for a frame's worth of audio plus rounding.
+    audio_frames = (unsigned)(config.sample_rate / config.fps) + 2;
+    audio_buf = calloc(audio_frames * 2, sizeof(*audio_buf));
+
+    // Contents are left to the frontend, which loads them after this returns.
+    save_ram = calloc(config.save_ram ? config.save_ram : 1, 1);
+
+    if (config.system_ram && !(system_ram = calloc(config.system_ram, 1)))
+        return false;
+    if (!frame_buf || !audio_buf || !save_ram)
+        return false;
+
+    if (system_ram && config.memory_map) {
+        struct retro_memory_descriptor descs[2] = {
+            { 0, system_ram, 0, 0x7e0000, 0, 0, config.system_ram, NULL },
+            { 0, system_ram, 0, 0x000000, 0x40e000, 0, config.system_ram < 0x2000 ? config.system_ram : 0x2000, NULL },
+        };
+        struct retro_memory_map map = { descs, 2 };
+
+        if (!environ_cb(RETRO_ENVIRONMENT_SET_MEMORY_MAPS, &map))
+            return false;
+    }
+
+    retro_reset();
+    return true;
+}
+
+bool retro_load_game_special(unsigned type, const struct retro_game_info *info, size_t num) {
+    return false;
+}
+
+void retro_unload_game(void) {
+    free(frame_buf);
+    free(audio_buf);
+    free(save_ram);
+    free(system_ram);
+    frame_buf = NULL;
+    audio_buf = NULL;
+    save_ram = NULL;
+    system_ram = NULL;
+}
+
+unsigned retro_get_region(void) {
+    return RETRO_REGION_NTSC;
+}
+
+void *retro_get_memory_data(unsigned id) {
+    if (id == RETRO_MEMORY_SYSTEM_RAM)
+        return system_ram;
+    return id == RETRO_MEMORY_SAVE_RAM && config.save_ram ? save_ram : NULL;
+}
+
+size_t retro_get_memory_size(unsigned id) {
+    if (id == RETRO_MEMORY_SYSTEM_RAM)
+        return system_ram ? config.system_ram : 0;
+    return id == RETRO_MEMORY_SAVE_RAM ? config.save_ram : 0;
+}
@@ -0,0 +1,72 @@
+#include <string.h>
+#include "viewport.h"
+
+static const char *mode_names[] = {
+    [VIEWPORT_ASPECT]  = "aspect",
+    [VIEWPORT_INTEGER] = "integer",
+    [VIEWPORT_STRETCH] = "stretch",
+};
+
+bool viewport_parse_mode(const char *name, enum viewport_mode *mode) {
+    unsigned i;
+
+    for (i = 0; i < sizeof(mode_names) / sizeof(mode_names[0]); ++i) {
+        if (!strcmp(name, mode_names[i])) {
+            *mode = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *viewport_mode_name(enum viewport_mode mode) {
+    return mode_names[mode];
+}
+
+void viewport_layout(enum viewport_mode mode, int screen_w, int screen_h,
+                     unsigned width, unsigned height, float aspect, struct viewport *vp) {
+    int w = screen_w, h = screen_h;
+
+    if (!width || !height || screen_w <= 0 || screen_h <= 0)
+        mode = VIEWPORT_STRETCH;
+
+    if (aspect <= 0 && height)
+        aspect = (float)width / height;
+
+    switch (mode) {
+    case VIEWPORT_INTEGER: {
+        // Scale the height by the largest factor whose aspect corrected
+        // width still fits, the width can then be fractional.
+        int scale = screen_h / (int)height;
+
+        while (scale > 1 && (int)(height * scale * aspect + 0.5f) > screen_w)
+            scale--;
+
+        if (scale >= 1) {
+            h = height * scale;
+            w = (int)(h * aspect + 0.5f);
+            if (w <= screen_w)
+                break;
+        }
+        // The window is smaller than the frame, fall back to fitting it.
+    }
+    /* fall through */
+    case VIEWPORT_ASPECT:
+        if ((float)screen_w / screen_h > aspect) {
+            h = screen_h;
+            w = (int)(screen_h * aspect + 0.5f);
+        } else {
+            w = screen_w;
+            h = (int)(screen_w / aspect + 0.5f);
+        }
+        break;
+    case VIEWPORT_STRETCH:
+        break;
+    }
+
+    vp->x = (screen_w - w) / 2;
+    vp->y = (screen_h - h) / 2;
+    vp->width = w;
+    vp->height = h;
+}
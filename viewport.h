@@ -0,0 +1,22 @@
+#pragma once
+#include <stdbool.h>
+
+enum viewport_mode {
+    VIEWPORT_ASPECT,  // largest rectangle with the core aspect ratio
+    VIEWPORT_INTEGER, // integer multiple of the core height, aspect corrected
+    VIEWPORT_STRETCH, // whole window
+};
+
+struct viewport {
+    int x, y;
+    int width, height;
+};
+
+// Accepts "aspect", "integer" or "stretch".
+bool viewport_parse_mode(const char *name, enum viewport_mode *mode);
+const char *viewport_mode_name(enum viewport_mode mode);
+
+// Places a width x height frame with the given display aspect ratio (<= 0
+// means square pixels) centered in the window.
+void viewport_layout(enum viewport_mode mode, int screen_w, int screen_h,
+                     unsigned width, unsigned height, float aspect, struct viewport *vp);